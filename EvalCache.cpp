@@ -0,0 +1,221 @@
+#include "EvalCache.hpp"
+
+#include <algorithm>    // For max, equal
+#include <cstring>      // For memcpy
+
+
+EvalCache::EvalCache(const size_t nbShards)
+  : _shards()
+{
+    for (size_t i = 0; i < std::max(nbShards, size_t(1)); i++)
+    {
+        _shards.push_back(std::unique_ptr<Shard>(new Shard()));
+    }
+}
+
+
+uint64_t EvalCache::hashCoords(const QueuePoint& point)
+{
+    uint64_t hash = point.getDimension();
+    for (size_t i = 0; i < point.getDimension(); i++)
+    {
+        // 0.0 and -0.0 are the same coordinate.
+        double coord = (0.0 == point.getCoord(i)) ? 0.0 : point.getCoord(i);
+        uint64_t bits;
+        std::memcpy(&bits, &coord, sizeof(bits));
+        // Mix the bits, so that close coordinates give different hashes.
+        hash = (hash ^ bits) * 0x9E3779B97F4A7C15ULL;
+        hash ^= (hash >> 29);
+    }
+    return hash;
+}
+
+
+size_t EvalCache::Shard::find(const uint64_t hash, const QueuePoint& point) const
+{
+    auto range = _index.equal_range(hash);
+    for (auto it = range.first; it != range.second; ++it)
+    {
+        const CachedEval& cachedEval = _evals[it->second];
+        if (cachedEval._dimension == point.getDimension()
+            && std::equal(point.getCoords(), point.getCoords() + point.getDimension(),
+                          _coords.begin() + cachedEval._offset))
+        {
+            return it->second;
+        }
+    }
+    return _evals.size();
+}
+
+
+size_t EvalCache::Shard::add(const uint64_t hash, const QueuePoint& point, const double eval, const State state)
+{
+    const size_t index = _evals.size();
+    CachedEval cachedEval;
+    cachedEval._offset = _coords.size();
+    cachedEval._dimension = point.getDimension();
+    cachedEval._eval = eval;
+    cachedEval._state = state;
+    _coords.insert(_coords.end(), point.getCoords(), point.getCoords() + point.getDimension());
+    _evals.push_back(cachedEval);
+    _index.emplace(hash, index);
+    if (State::EVALUATED != state)
+    {
+        _nbNotEvaluated++;
+    }
+    return index;
+}
+
+
+bool EvalCache::find(const QueuePoint& point, double& eval) const
+{
+    const uint64_t hash = hashCoords(point);
+    Shard& shard = getShard(hash);
+
+    omp_set_lock(&shard._lock);
+    size_t index = shard.find(hash, point);
+    bool found = (index < shard._evals.size() && State::EVALUATED == shard._evals[index]._state);
+    if (found)
+    {
+        eval = shard._evals[index]._eval;
+        shard._nbHits++;
+    }
+    else
+    {
+        shard._nbMisses++;
+    }
+    omp_unset_lock(&shard._lock);
+
+    return found;
+}
+
+
+void EvalCache::insert(const QueuePoint& point, const double eval)
+{
+    const uint64_t hash = hashCoords(point);
+    Shard& shard = getShard(hash);
+
+    omp_set_lock(&shard._lock);
+    size_t index = shard.find(hash, point);
+    if (index < shard._evals.size())
+    {
+        CachedEval& cachedEval = shard._evals[index];
+        if (State::EVALUATED != cachedEval._state)
+        {
+            cachedEval._state = State::EVALUATED;
+            shard._nbNotEvaluated--;
+        }
+        cachedEval._eval = eval;
+    }
+    else
+    {
+        shard.add(hash, point, eval, State::EVALUATED);
+    }
+    omp_unset_lock(&shard._lock);
+}
+
+
+CacheLookup EvalCache::claim(const QueuePoint& point, double& eval)
+{
+    const uint64_t hash = hashCoords(point);
+    Shard& shard = getShard(hash);
+
+    CacheLookup lookup = CacheLookup::CLAIMED;
+    omp_set_lock(&shard._lock);
+    size_t index = shard.find(hash, point);
+    if (index == shard._evals.size())
+    {
+        shard.add(hash, point, 0, State::PENDING);
+    }
+    else
+    {
+        CachedEval& cachedEval = shard._evals[index];
+        switch (cachedEval._state)
+        {
+            case State::EVALUATED:
+                eval = cachedEval._eval;
+                shard._nbHits++;
+                lookup = CacheLookup::HIT;
+                break;
+            case State::PENDING:
+                lookup = CacheLookup::PENDING;
+                break;
+            case State::RELEASED:
+                cachedEval._state = State::PENDING;
+                break;
+        }
+    }
+    omp_unset_lock(&shard._lock);
+
+    return lookup;
+}
+
+
+void EvalCache::release(const QueuePoint& point)
+{
+    const uint64_t hash = hashCoords(point);
+    Shard& shard = getShard(hash);
+
+    omp_set_lock(&shard._lock);
+    size_t index = shard.find(hash, point);
+    if (index < shard._evals.size() && State::PENDING == shard._evals[index]._state)
+    {
+        shard._evals[index]._state = State::RELEASED;
+    }
+    omp_unset_lock(&shard._lock);
+}
+
+
+size_t EvalCache::size() const
+{
+    size_t nbEvals = 0;
+    for (auto& shard : _shards)
+    {
+        omp_set_lock(&shard->_lock);
+        nbEvals += shard->_evals.size() - shard->_nbNotEvaluated;
+        omp_unset_lock(&shard->_lock);
+    }
+    return nbEvals;
+}
+
+
+size_t EvalCache::getNbHits() const
+{
+    size_t nbHits = 0;
+    for (auto& shard : _shards)
+    {
+        omp_set_lock(&shard->_lock);
+        nbHits += shard->_nbHits;
+        omp_unset_lock(&shard->_lock);
+    }
+    return nbHits;
+}
+
+
+size_t EvalCache::getNbMisses() const
+{
+    size_t nbMisses = 0;
+    for (auto& shard : _shards)
+    {
+        omp_set_lock(&shard->_lock);
+        nbMisses += shard->_nbMisses;
+        omp_unset_lock(&shard->_lock);
+    }
+    return nbMisses;
+}
+
+
+void EvalCache::clear()
+{
+    for (auto& shard : _shards)
+    {
+        omp_set_lock(&shard->_lock);
+        shard->_index.clear();
+        shard->_evals.clear();
+        shard->_coords.clear();
+        shard->_nbNotEvaluated = 0;
+        shard->_nbHits = 0;
+        shard->_nbMisses = 0;
+        omp_unset_lock(&shard->_lock);
+    }
+}
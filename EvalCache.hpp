@@ -0,0 +1,122 @@
+#ifndef __EVALCACHE_HPP__
+#define __EVALCACHE_HPP__
+
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+#include "QueuePoint.hpp"
+
+// Result of EvalCache::claim().
+enum class CacheLookup
+{
+    HIT,        // The point is evaluated: its evaluation is given
+    CLAIMED,    // The point is not evaluated: the caller must evaluate it
+    PENDING     // Another thread claimed the point and is evaluating it
+};
+
+
+// Cache of evaluations, keyed on the coordinates of the points.
+// The cache is split in shards, each with its own lock, so that threads
+// looking for different points rarely wait for each other.
+// A thread claims a point before evaluating it, so that two threads do
+// not evaluate points with the same coordinates at the same time.
+class EvalCache
+{
+private:
+    enum class State
+    {
+        EVALUATED,
+        PENDING,    // Claimed, _eval is not set yet
+        RELEASED    // Claimed, then released without an evaluation
+    };
+
+    // Evaluation of a point. Its coordinates are in the shard's _coords.
+    class CachedEval
+    {
+    public:
+        size_t _offset;         // Index of the first coordinate in _coords
+        size_t _dimension;
+        double _eval;
+        State _state;
+    };
+
+    class Shard
+    {
+    public:
+        std::unordered_multimap<uint64_t, size_t> _index;   // Hash of the coordinates -> index in _evals
+        std::vector<CachedEval> _evals;
+        std::vector<double> _coords;    // Coordinates of all cached points, contiguous
+        size_t _nbNotEvaluated;         // Entries of _evals that are PENDING or RELEASED
+        size_t _nbHits;
+        size_t _nbMisses;
+        mutable omp_lock_t _lock;
+
+        Shard()
+          : _index(),
+            _evals(),
+            _coords(),
+            _nbNotEvaluated(0),
+            _nbHits(0),
+            _nbMisses(0),
+            _lock()
+        {
+            omp_init_lock(&_lock);
+        }
+
+        ~Shard()
+        {
+            omp_destroy_lock(&_lock);
+        }
+
+        // Index in _evals of the point with these coordinates,
+        // or _evals.size() if there is none. The shard must be locked.
+        size_t find(const uint64_t hash, const QueuePoint& point) const;
+        // Add the point to _evals, and return its index. The point must
+        // not be found. The shard must be locked.
+        size_t add(const uint64_t hash, const QueuePoint& point, const double eval, const State state);
+    };
+
+    std::vector<std::unique_ptr<Shard>> _shards;
+
+    // Hash of the coordinates, the same for 0.0 and -0.0.
+    static uint64_t hashCoords(const QueuePoint& point);
+    Shard& getShard(const uint64_t hash) const { return *_shards[(hash >> 32) % _shards.size()]; }
+
+public:
+    // Constructor
+    explicit EvalCache(const size_t nbShards = 64);
+
+    // Destructor
+    virtual ~EvalCache() {}
+
+    // Look for the point's coordinates. If found, set eval and return true.
+    // Counts a hit or a miss.
+    bool find(const QueuePoint& point, double& eval) const;
+
+    // Store the evaluation of the point. Ends the claim of the point,
+    // if any.
+    void insert(const QueuePoint& point, const double eval);
+
+    // Look for the point's coordinates, and claim them if they are not
+    // evaluated: the caller must then evaluate the point and insert() its
+    // evaluation, or release() the claim. Return PENDING if another thread
+    // claimed them. On HIT, eval is set and a hit is counted. Misses are
+    // only counted by find().
+    CacheLookup claim(const QueuePoint& point, double& eval);
+
+    // End the claim of the point without an evaluation, e.g. when the
+    // evaluation failed. Another thread may then claim the point.
+    void release(const QueuePoint& point);
+
+    // Get/Set
+    // Number of evaluations in the cache.
+    size_t size() const;
+    size_t getNbHits() const;
+    size_t getNbMisses() const;
+
+    void clear();
+};
+
+
+#endif // __EVALCACHE_HPP__
@@ -0,0 +1,212 @@
+#include "EvalJournal.hpp"
+
+#include <algorithm>    // For copy
+#include <cerrno>
+#include <chrono>
+#include <cstring>      // For strerror
+#include <fcntl.h>      // For open
+#include <stdexcept>    // For runtime_error, invalid_argument, length_error
+#include <sys/mman.h>   // For mmap, msync, munmap
+#include <sys/stat.h>   // For fstat
+#include <unistd.h>     // For pread, pwrite, ftruncate, close
+
+
+// Error of the last system call, from errno: build it before any other
+// system call, e.g. close(), changes errno.
+static std::runtime_error journalError(const std::string& fileName, const std::string& what)
+{
+    return std::runtime_error("EvalJournal: " + what + " " + fileName + ": " + std::strerror(errno));
+}
+
+
+EvalJournal::EvalJournal(const std::string& fileName, const size_t dimension)
+  : _fileName(fileName),
+    _dimension(dimension),
+    _recordSize(sizeof(Record) + dimension * sizeof(double)),
+    _fd(-1),
+    _chunks(new std::atomic<char*>[MAX_NB_CHUNKS]),
+    _nbRecords(0),
+    _lock()
+{
+    for (size_t i = 0; i < MAX_NB_CHUNKS; i++)
+    {
+        _chunks[i].store(nullptr, std::memory_order_relaxed);
+    }
+
+    _fd = open(fileName.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (_fd < 0)
+    {
+        throw journalError(fileName, "cannot open");
+    }
+
+    struct stat fileStat;
+    if (0 != fstat(_fd, &fileStat))
+    {
+        const std::runtime_error error = journalError(fileName, "cannot stat");
+        close(_fd);
+        throw error;
+    }
+
+    Header header;
+    if (size_t(fileStat.st_size) < HEADER_SIZE)
+    {
+        // New journal.
+        header._magic = MAGIC;
+        header._version = VERSION;
+        header._dimension = uint32_t(dimension);
+        if (0 != ftruncate(_fd, HEADER_SIZE)
+            || ssize_t(sizeof(header)) != pwrite(_fd, &header, sizeof(header), 0))
+        {
+            const std::runtime_error error = journalError(fileName, "cannot write header of");
+            close(_fd);
+            throw error;
+        }
+    }
+    else
+    {
+        if (ssize_t(sizeof(header)) != pread(_fd, &header, sizeof(header), 0))
+        {
+            const std::runtime_error error = journalError(fileName, "cannot read header of");
+            close(_fd);
+            throw error;
+        }
+        if (MAGIC != header._magic || VERSION != header._version || dimension != header._dimension)
+        {
+            close(_fd);
+            throw std::runtime_error("EvalJournal: " + fileName + " is not a journal of points of dimension "
+                                     + std::to_string(dimension));
+        }
+
+        // Map the existing chunks. New records go after the last
+        // committed one.
+        const size_t nbChunks = std::min((size_t(fileStat.st_size) - HEADER_SIZE) / getChunkBytes(), MAX_NB_CHUNKS);
+        for (size_t chunkIndex = 0; chunkIndex < nbChunks; chunkIndex++)
+        {
+            char* chunk = nullptr;
+            try
+            {
+                chunk = mapChunk(chunkIndex);
+            }
+            catch (...)
+            {
+                unmapChunks();
+                close(_fd);
+                throw;
+            }
+            for (size_t index = chunkIndex * CHUNK_SIZE; index < (chunkIndex + 1) * CHUNK_SIZE; index++)
+            {
+                if (commitWord(index) == getRecord(chunk, index)._commit.load(std::memory_order_relaxed))
+                {
+                    _nbRecords.store(index + 1, std::memory_order_relaxed);
+                }
+            }
+        }
+    }
+
+    omp_init_lock(&_lock);
+}
+
+
+EvalJournal::~EvalJournal()
+{
+    sync();
+    unmapChunks();
+    close(_fd);
+    omp_destroy_lock(&_lock);
+}
+
+
+void EvalJournal::unmapChunks()
+{
+    for (size_t i = 0; i < MAX_NB_CHUNKS; i++)
+    {
+        char* chunk = _chunks[i].exchange(nullptr);
+        if (nullptr != chunk)
+        {
+            munmap(chunk, getChunkBytes());
+        }
+    }
+}
+
+
+char* EvalJournal::mapChunk(const size_t chunkIndex)
+{
+    // The file only grows: a chunk mapped by another thread is never cut.
+    const off_t offset = off_t(HEADER_SIZE + chunkIndex * getChunkBytes());
+    struct stat fileStat;
+    if (0 != fstat(_fd, &fileStat))
+    {
+        throw journalError(_fileName, "cannot stat");
+    }
+    if (fileStat.st_size < offset + off_t(getChunkBytes())
+        && 0 != ftruncate(_fd, offset + off_t(getChunkBytes())))
+    {
+        throw journalError(_fileName, "cannot grow");
+    }
+
+    void* chunk = mmap(nullptr, getChunkBytes(), PROT_READ | PROT_WRITE, MAP_SHARED, _fd, offset);
+    if (MAP_FAILED == chunk)
+    {
+        throw journalError(_fileName, "cannot map");
+    }
+    _chunks[chunkIndex].store(static_cast<char*>(chunk), std::memory_order_release);
+
+    return static_cast<char*>(chunk);
+}
+
+
+void EvalJournal::append(const QueuePoint& point, const double eval)
+{
+    if (point.getDimension() != _dimension)
+    {
+        throw std::invalid_argument("EvalJournal: point of dimension " + std::to_string(point.getDimension())
+                                    + " in journal of dimension " + std::to_string(_dimension));
+    }
+
+    const size_t index = _nbRecords.fetch_add(1, std::memory_order_relaxed);
+    const size_t chunkIndex = index / CHUNK_SIZE;
+    if (chunkIndex >= MAX_NB_CHUNKS)
+    {
+        throw std::length_error("EvalJournal: maximum number of records reached");
+    }
+
+    char* chunk = _chunks[chunkIndex].load(std::memory_order_acquire);
+    if (nullptr == chunk)
+    {
+        omp_set_lock(&_lock);
+        chunk = _chunks[chunkIndex].load(std::memory_order_relaxed);
+        if (nullptr == chunk)
+        {
+            try
+            {
+                chunk = mapChunk(chunkIndex);
+            }
+            catch (...)
+            {
+                omp_unset_lock(&_lock);
+                throw;
+            }
+        }
+        omp_unset_lock(&_lock);
+    }
+
+    // The record belongs to this thread until it is committed.
+    Record& record = getRecord(chunk, index);
+    std::copy(point.getCoords(), point.getCoords() + _dimension, reinterpret_cast<double*>(&record + 1));
+    record._time = std::chrono::duration<double>(std::chrono::system_clock::now().time_since_epoch()).count();
+    record._eval = eval;
+    record._commit.store(commitWord(index), std::memory_order_release);
+}
+
+
+void EvalJournal::sync() const
+{
+    for (size_t i = 0; i < MAX_NB_CHUNKS; i++)
+    {
+        char* chunk = _chunks[i].load(std::memory_order_acquire);
+        if (nullptr != chunk)
+        {
+            msync(chunk, getChunkBytes(), MS_SYNC);
+        }
+    }
+}
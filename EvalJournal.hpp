@@ -0,0 +1,132 @@
+#ifndef __EVALJOURNAL_HPP__
+#define __EVALJOURNAL_HPP__
+
+#include <atomic>
+#include <cstdint>      // For uint32_t, uint64_t
+#include <memory>
+#include <omp.h>
+#include <string>
+
+#include "QueuePoint.hpp"
+
+// Append-only journal of evaluations, in a memory-mapped binary file.
+// Each evaluation is a fixed-size record: coordinates, eval and time.
+// Points that are queued but not evaluated are not recorded.
+// Threads append records without a global lock: a record index is taken
+// with an atomic increment, and the record is committed by writing its
+// commit word last. The file grows by chunks of records; only mapping a
+// new chunk takes a lock.
+// Records are written in shared memory mappings, so they survive a crash
+// of the process as soon as they are committed. sync() also writes them
+// to the disk.
+// When an existing file is opened, its committed records are kept and
+// new records are appended after them. Records that were not committed
+// when the process died are ignored.
+class EvalJournal
+{
+private:
+    static constexpr uint64_t MAGIC = 0x4c4e524a4c415645ull;  // "EVALJRNL"
+    static constexpr uint32_t VERSION = 1;
+    static constexpr size_t HEADER_SIZE = 4096;     // Keeps chunks page-aligned
+    static constexpr size_t CHUNK_SIZE = 4096;      // Records per chunk
+    static constexpr size_t MAX_NB_CHUNKS = 1u << 16;
+
+    class Header
+    {
+    public:
+        uint64_t _magic;
+        uint32_t _version;
+        uint32_t _dimension;
+    };
+
+    // Followed by the coordinates of the point.
+    class Record
+    {
+    public:
+        std::atomic<uint64_t> _commit;  // commitWord(index) once the record is complete
+        double _time;                   // Seconds since the epoch
+        double _eval;
+    };
+
+    std::string _fileName;
+    size_t _dimension;
+    size_t _recordSize;     // In bytes, with the coordinates
+    int _fd;
+    std::unique_ptr<std::atomic<char*>[]> _chunks;  // Mapped chunks, nullptr if not mapped yet
+    std::atomic<size_t> _nbRecords;     // Index of the next record
+    mutable omp_lock_t _lock;           // Protects mapping of chunks
+
+    static uint64_t commitWord(const size_t index) { return MAGIC ^ uint64_t(index); }
+
+    size_t getChunkBytes() const { return CHUNK_SIZE * _recordSize; }
+    Record& getRecord(char* chunk, const size_t index) const
+    {
+        return *reinterpret_cast<Record*>(chunk + (index % CHUNK_SIZE) * _recordSize);
+    }
+    // Map the chunk, and grow the file if needed.
+    char* mapChunk(const size_t chunkIndex);
+    // Unmap all mapped chunks.
+    void unmapChunks();
+
+public:
+    // Constructor
+    // Open the journal file, or create it. Throws std::runtime_error if
+    // the file cannot be opened or mapped, or if it is not a journal of
+    // points of this dimension.
+    explicit EvalJournal(const std::string& fileName, const size_t dimension);
+
+    // Destructor
+    virtual ~EvalJournal();
+
+    // The mappings cannot be copied.
+    EvalJournal(const EvalJournal&) = delete;
+    EvalJournal& operator=(const EvalJournal&) = delete;
+
+    // Get/Set
+    const std::string& getFileName() const { return _fileName; }
+    size_t getDimension() const { return _dimension; }
+    // Number of records appended or reloaded, including uncommitted ones.
+    size_t getNbRecords() const { return _nbRecords.load(std::memory_order_relaxed); }
+
+    // Append the evaluation of the point. Thread-safe.
+    // Throws std::invalid_argument if the dimension of the point is not
+    // the dimension of the journal.
+    void append(const QueuePoint& point, const double eval);
+
+    // Call f(coords, eval, time) for each committed record, in order.
+    // Records being appended by other threads may be skipped.
+    template <typename F>
+    size_t forEach(F f) const;
+
+    // Write the mapped records to the disk.
+    void sync() const;
+};
+
+
+template <typename F>
+size_t EvalJournal::forEach(F f) const
+{
+    size_t nbCommitted = 0;
+    const size_t nbRecords = getNbRecords();
+    for (size_t index = 0; index < nbRecords; index++)
+    {
+        char* chunk = _chunks[index / CHUNK_SIZE].load(std::memory_order_acquire);
+        if (nullptr == chunk)
+        {
+            // Being mapped by an appending thread.
+            index += CHUNK_SIZE - 1 - index % CHUNK_SIZE;
+            continue;
+        }
+        const Record& record = getRecord(chunk, index);
+        if (commitWord(index) == record._commit.load(std::memory_order_acquire))
+        {
+            const double* coords = reinterpret_cast<const double*>(&record + 1);
+            f(coords, record._eval, record._time);
+            nbCommitted++;
+        }
+    }
+    return nbCommitted;
+}
+
+
+#endif // __EVALJOURNAL_HPP__
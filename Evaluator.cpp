@@ -0,0 +1,118 @@
+#include "Evaluator.hpp"
+
+#include <algorithm>    // For push_heap, pop_heap, min
+#include <chrono>
+#include <random>       // For minstd_rand
+#include <thread>       // For sleep_for
+
+#include "Threading.hpp"
+
+
+void MockEvaluator::eval(const PointBatch& batch, double* evals) const
+{
+    static thread_local std::minstd_rand generator(std::random_device{}() + Threading::getThreadNum());
+    std::uniform_int_distribution<int> distribution(1, 50);
+    for (size_t i = 0; i < batch.size(); i++)
+    {
+        evals[i] = distribution(generator);
+    }
+}
+
+
+void RosenbrockEvaluator::eval(const PointBatch& batch, double* evals) const
+{
+    const size_t n = batch.size();
+    const size_t dimension = batch.getDimension();
+    for (size_t i = 0; i < n; i++)
+    {
+        const double* x = batch.getCoords(i);
+        double sum = 0.0;
+        #pragma omp simd reduction(+:sum)
+        for (size_t j = 1; j < dimension; j++)
+        {
+            double d1 = _a - x[j - 1];
+            double d2 = x[j] - x[j - 1] * x[j - 1];
+            sum += d1 * d1 + _b * d2 * d2;
+        }
+        evals[i] = sum;
+    }
+}
+
+
+void QuadraticEvaluator::eval(const PointBatch& batch, double* evals) const
+{
+    const size_t n = batch.size();
+    const size_t dimension = batch.getDimension();
+    for (size_t i = 0; i < n; i++)
+    {
+        const double* x = batch.getCoords(i);
+        evals[i] = _center.empty() ? dot(x, x, dimension)
+                                   : squaredDistance(x, _center.data(), dimension);
+    }
+}
+
+
+SimulatedAsyncEvaluator::SimulatedAsyncEvaluator(const std::shared_ptr<Evaluator>& evaluator,
+                                                 const double latency)
+  : SimulatedAsyncEvaluator(evaluator, LatencyFunction([latency]() { return latency; }))
+{
+}
+
+
+SimulatedAsyncEvaluator::SimulatedAsyncEvaluator(const std::shared_ptr<Evaluator>& evaluator,
+                                                 const LatencyFunction& latency)
+  : _evaluator(evaluator),
+    _latency(latency),
+    _nbThreads(Threading::getMaxThreads()),
+    _threadStates(new ThreadState[_nbThreads])
+{
+}
+
+
+void SimulatedAsyncEvaluator::submit(const PointBatch& batch, const uint64_t* tags)
+{
+    ThreadState& state = _threadStates[Threading::getThreadNum() % _nbThreads];
+    state._evals.resize(batch.size());
+    _evaluator->eval(batch, state._evals.data());
+
+    const double now = omp_get_wtime();
+    for (size_t i = 0; i < batch.size(); i++)
+    {
+        PendingEval pending;
+        pending._readyTime = now + _latency();
+        pending._result._tag = tags[i];
+        pending._result._eval = state._evals[i];
+        state._pending.push_back(pending);
+        std::push_heap(state._pending.begin(), state._pending.end());
+    }
+}
+
+
+size_t SimulatedAsyncEvaluator::poll(std::vector<AsyncResult>& results, const double timeout)
+{
+    ThreadState& state = _threadStates[Threading::getThreadNum() % _nbThreads];
+    if (state._pending.empty())
+    {
+        return 0;
+    }
+
+    // Wait for the first evaluation to be ready, or for the timeout.
+    double now = omp_get_wtime();
+    const double readyTime = state._pending.front()._readyTime;
+    if (readyTime > now && timeout > 0.0)
+    {
+        std::this_thread::sleep_for(std::chrono::duration<double>(std::min(readyTime, now + timeout) - now));
+        now = omp_get_wtime();
+    }
+
+    size_t nbResults = 0;
+    while (!state._pending.empty() && state._pending.front()._readyTime <= now)
+    {
+        results.push_back(state._pending.front()._result);
+        std::pop_heap(state._pending.begin(), state._pending.end());
+        state._pending.pop_back();
+        nbResults++;
+    }
+
+    return nbResults;
+}
@@ -0,0 +1,146 @@
+#ifndef __EVALUATOR_HPP__
+#define __EVALUATOR_HPP__
+
+#include <memory>
+#include <vector>
+
+#include "QueuePoint.hpp"
+
+// Evaluation of batches of points, called by the Queue.
+// Points are given as a PointBatch, with coordinates in contiguous arrays,
+// so that analytic functions can be evaluated with vectorized kernels.
+// eval() is called concurrently by all threads running the queue:
+// implementations must be thread-safe.
+class Evaluator
+{
+public:
+    virtual ~Evaluator() {}
+
+    // Evaluate all points of batch. evals[i] is the evaluation of point i,
+    // or NaN if the point could not be evaluated.
+    virtual void eval(const PointBatch& batch, double* evals) const = 0;
+};
+
+
+// Mock evaluation: random integer eval between 1 and 50.
+// Each thread has its own random generator, so there is no
+// shared state between threads.
+class MockEvaluator : public Evaluator
+{
+public:
+    void eval(const PointBatch& batch, double* evals) const override;
+};
+
+
+// Rosenbrock function: sum over i of (a - x_i)^2 + b (x_{i+1} - x_i^2)^2.
+class RosenbrockEvaluator : public Evaluator
+{
+private:
+    double _a;
+    double _b;
+
+public:
+    explicit RosenbrockEvaluator(const double a = 1.0, const double b = 100.0)
+      : _a(a),
+        _b(b)
+    {}
+
+    void eval(const PointBatch& batch, double* evals) const override;
+};
+
+
+// Quadratic function: square distance to the center.
+// The default center is the origin.
+class QuadraticEvaluator : public Evaluator
+{
+private:
+    std::vector<double> _center;    // Empty for the origin
+
+public:
+    explicit QuadraticEvaluator(const std::vector<double>& center = std::vector<double>())
+      : _center(center)
+    {}
+
+    void eval(const PointBatch& batch, double* evals) const override;
+};
+
+
+// Result of an asynchronous evaluation.
+class AsyncResult
+{
+public:
+    uint64_t _tag;      // Tag given to submit() for this point
+    double _eval;       // NaN if the point could not be evaluated
+};
+
+
+// Asynchronous evaluation of batches of points, for blackboxes that run
+// outside of the process: a thread starts evaluations with submit(),
+// keeps several of them in flight, and gets the evaluations that are
+// done with poll().
+// submit() and poll() are called concurrently by all threads running the
+// queue. poll() only returns evaluations submitted by the calling thread.
+class AsyncEvaluator
+{
+public:
+    virtual ~AsyncEvaluator() {}
+
+    // Start the evaluation of all points of batch, and return at once.
+    // tags[i] identifies point i in the results of poll().
+    virtual void submit(const PointBatch& batch, const uint64_t* tags) = 0;
+
+    // Append to results the evaluations submitted by the current thread
+    // that are done. If none is done, wait for one at most timeout seconds.
+    // Return the number of results appended.
+    virtual size_t poll(std::vector<AsyncResult>& results, const double timeout) = 0;
+};
+
+
+// Simulation of a remote blackbox: the values are computed by an Evaluator
+// when the points are submitted, and are returned by poll() only after
+// a latency.
+class SimulatedAsyncEvaluator : public AsyncEvaluator
+{
+public:
+    // Latency of the evaluation of a single point, in seconds.
+    typedef std::function<double()> LatencyFunction;
+
+private:
+    class PendingEval
+    {
+    public:
+        double _readyTime;
+        AsyncResult _result;
+
+        // For a min-heap on the ready time.
+        bool operator<(const PendingEval& other) const { return _readyTime > other._readyTime; }
+    };
+
+    // Evaluations submitted by a thread.
+    class alignas(64) ThreadState
+    {
+    public:
+        std::vector<PendingEval> _pending;  // Min-heap on the ready time
+        std::vector<double> _evals;
+    };
+
+    std::shared_ptr<Evaluator> _evaluator;
+    LatencyFunction _latency;
+    size_t _nbThreads;
+    std::unique_ptr<ThreadState[]> _threadStates;   // Indexed by thread number modulo _nbThreads
+
+public:
+    // Constructor, with a constant latency.
+    explicit SimulatedAsyncEvaluator(const std::shared_ptr<Evaluator>& evaluator,
+                                     const double latency);
+    // Constructor, with a latency drawn for each point.
+    // latency() is called concurrently by all threads.
+    explicit SimulatedAsyncEvaluator(const std::shared_ptr<Evaluator>& evaluator,
+                                     const LatencyFunction& latency);
+
+    void submit(const PointBatch& batch, const uint64_t* tags) override;
+    size_t poll(std::vector<AsyncResult>& results, const double timeout) override;
+};
+
+
+#endif // __EVALUATOR_HPP__
@@ -0,0 +1,252 @@
+#include "Logger.hpp"
+
+#include <algorithm>    // For min, stable_sort
+#include <chrono>
+#include <iostream>
+#include <omp.h>
+
+
+std::atomic<int> Logger::_level(int(LogLevel::INFO));
+
+
+Logger::Logger()
+  : _rings(new std::atomic<Ring*>[MAX_NB_THREADS]),
+    _nbRings(0),
+    _drained(),
+    _stopWriter(false),
+    _wakeRequested(false)
+{
+    for (size_t i = 0; i < MAX_NB_THREADS; i++)
+    {
+        _rings[i].store(nullptr, std::memory_order_relaxed);
+    }
+    _writer = std::thread(&Logger::writerLoop, this);
+}
+
+
+Logger::~Logger()
+{
+    {
+        std::lock_guard<std::mutex> lock(_writerMutex);
+        _stopWriter = true;
+    }
+    _writerCond.notify_one();
+    _writer.join();
+
+    // Messages logged after the last pass of the writer.
+    drain();
+
+    for (size_t i = 0; i < MAX_NB_THREADS; i++)
+    {
+        delete _rings[i].load(std::memory_order_relaxed);
+    }
+}
+
+
+Logger& Logger::getInstance()
+{
+    // Created by the first message, destroyed at exit, after all
+    // messages are written.
+    static Logger logger;
+    return logger;
+}
+
+
+Logger::LocalState::~LocalState()
+{
+    // The messages left in the ring are written by the next drain.
+    if (nullptr != _ring)
+    {
+        _ring->_inUse.store(false, std::memory_order_release);
+    }
+}
+
+
+Logger::LocalState& Logger::getLocalState()
+{
+    thread_local LocalState state;
+    if (!state._registered)
+    {
+        state._registered = true;
+        state._ring = getInstance().acquireRing();
+    }
+    return state;
+}
+
+
+Logger::Ring* Logger::acquireRing()
+{
+    // Rings are kept until the end of the program: their messages may
+    // still have to be written after their thread is gone.
+    size_t nbRings = std::min(_nbRings.load(std::memory_order_acquire), MAX_NB_THREADS);
+    for (size_t i = 0; i < nbRings; i++)
+    {
+        Ring* ring = _rings[i].load(std::memory_order_acquire);
+        bool inUse = false;
+        if (nullptr != ring && ring->_inUse.compare_exchange_strong(inUse, true, std::memory_order_acq_rel))
+        {
+            return ring;
+        }
+    }
+
+    size_t ringIndex = _nbRings.fetch_add(1, std::memory_order_relaxed);
+    if (ringIndex >= MAX_NB_THREADS)
+    {
+        return nullptr;
+    }
+    Ring* ring = new Ring();
+    _rings[ringIndex].store(ring, std::memory_order_release);
+    return ring;
+}
+
+
+std::ostream& Logger::startMessage()
+{
+    LocalState& state = getLocalState();
+    state._record = &state._scratch;
+    Ring* ring = state._ring;
+    if (nullptr != ring)
+    {
+        // The record at head is not read by the consumer until log()
+        // moves head.
+        size_t head = ring->_head.load(std::memory_order_relaxed);
+        if (head - ring->_tail.load(std::memory_order_acquire) < RING_SIZE)
+        {
+            state._record = &ring->_records[head % RING_SIZE];
+        }
+    }
+    state._buffer.reset(state._record->_text);
+    return state._stream;
+}
+
+
+void Logger::log(const LogLevel level)
+{
+    LocalState& state = getLocalState();
+    Record& record = *state._record;
+    record._time = omp_get_wtime();
+    record._level = level;
+    record._length = uint32_t(state._buffer.getLength());
+
+    if (&record != &state._scratch)
+    {
+        Ring& ring = *state._ring;
+        size_t head = ring._head.fetch_add(1, std::memory_order_release) + 1;
+        if (head - ring._tail.load(std::memory_order_relaxed) >= WAKE_THRESHOLD || level <= LogLevel::WARNING)
+        {
+            getInstance().wakeWriter();
+        }
+    }
+    else if (nullptr == state._ring || level <= LogLevel::WARNING)
+    {
+        getInstance().writeSynchronously(record);
+    }
+    else
+    {
+        state._ring->_nbDropped.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+
+void Logger::writeSynchronously(const Record& record)
+{
+    drain();
+
+    std::lock_guard<std::mutex> lock(_drainMutex);
+    std::ostream& os = (record._level <= LogLevel::WARNING) ? std::cerr : std::cout;
+    os.write(record._text, record._length);
+    os.put('\n');
+    os.flush();
+}
+
+
+void Logger::wakeWriter()
+{
+    // Only the first request locks the mutex, until the writer wakes up.
+    if (_wakeRequested.load(std::memory_order_relaxed) || _wakeRequested.exchange(true))
+    {
+        return;
+    }
+    {
+        // The writer is either waiting, or checks _wakeRequested before it waits.
+        std::lock_guard<std::mutex> lock(_writerMutex);
+    }
+    _writerCond.notify_one();
+}
+
+
+void Logger::flush()
+{
+    getInstance().drain();
+}
+
+
+void Logger::drain()
+{
+    std::lock_guard<std::mutex> lock(_drainMutex);
+
+    // Copy the records of all rings, then write them in time order.
+    // The buffer keeps its capacity from one pass to the next.
+    std::vector<Record>& records = _drained;
+    records.clear();
+    size_t nbDropped = 0;
+    size_t nbRings = std::min(_nbRings.load(std::memory_order_relaxed), MAX_NB_THREADS);
+    for (size_t i = 0; i < nbRings; i++)
+    {
+        Ring* ring = _rings[i].load(std::memory_order_acquire);
+        if (nullptr == ring)
+        {
+            // Registered, but not yet published.
+            continue;
+        }
+        size_t tail = ring->_tail.load(std::memory_order_relaxed);
+        size_t head = ring->_head.load(std::memory_order_acquire);
+        for (; tail < head; tail++)
+        {
+            records.push_back(ring->_records[tail % RING_SIZE]);
+        }
+        ring->_tail.store(tail, std::memory_order_release);
+        nbDropped += ring->_nbDropped.exchange(0, std::memory_order_relaxed);
+    }
+
+    std::stable_sort(records.begin(), records.end(),
+                     [](const Record& r1, const Record& r2) { return r1._time < r2._time; });
+
+    bool coutUsed = false, cerrUsed = false;
+    for (const auto& record : records)
+    {
+        bool isError = (record._level <= LogLevel::WARNING);
+        std::ostream& os = isError ? std::cerr : std::cout;
+        os.write(record._text, record._length);
+        os.put('\n');
+        coutUsed |= !isError;
+        cerrUsed |= isError;
+    }
+    if (nbDropped > 0)
+    {
+        std::cerr << "Logger: " << nbDropped << " messages dropped, log buffers were full." << std::endl;
+    }
+    if (coutUsed)
+    {
+        std::cout.flush();
+    }
+    if (cerrUsed)
+    {
+        std::cerr.flush();
+    }
+}
+
+
+void Logger::writerLoop()
+{
+    std::unique_lock<std::mutex> lock(_writerMutex);
+    while (!_stopWriter)
+    {
+        _writerCond.wait_for(lock, std::chrono::milliseconds(MAX_LATENCY_MS),
+                             [this]() { return _stopWriter || _wakeRequested.load(); });
+        _wakeRequested.store(false);
+        lock.unlock();
+        drain();
+        lock.lock();
+    }
+}
@@ -0,0 +1,183 @@
+#ifndef __LOGGER_HPP__
+#define __LOGGER_HPP__
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>      // For uint32_t
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <streambuf>
+#include <thread>
+#include <vector>
+
+// Levels of log messages, from the most to the least important.
+enum class LogLevel
+{
+    ERROR = 0,
+    WARNING,
+    INFO,
+    DEBUG,
+    TRACE       // Very frequent events, e.g. each iteration of Queue::run() and each lock
+};
+
+// Messages with a level above LOG_MAX_LEVEL are removed at compile time.
+// E.g. -DLOG_MAX_LEVEL=2 keeps ERROR, WARNING and INFO messages only.
+#ifndef LOG_MAX_LEVEL
+#define LOG_MAX_LEVEL 4
+#endif
+
+// Log a message, written with operator<<, e.g.
+//   LOG_INFO("Eval point " << point << " to " << eval);
+// The message is only formatted if its level is enabled.
+#define LOG_MESSAGE(level, message) \
+    do \
+    { \
+        if (int(level) <= LOG_MAX_LEVEL && Logger::isEnabled(level)) \
+        { \
+            Logger::startMessage() << message; \
+            Logger::log(level); \
+        } \
+    } while (0)
+
+#define LOG_ERROR(message)   LOG_MESSAGE(LogLevel::ERROR, message)
+#define LOG_WARNING(message) LOG_MESSAGE(LogLevel::WARNING, message)
+#define LOG_INFO(message)    LOG_MESSAGE(LogLevel::INFO, message)
+#define LOG_DEBUG(message)   LOG_MESSAGE(LogLevel::DEBUG, message)
+#define LOG_TRACE(message)   LOG_MESSAGE(LogLevel::TRACE, message)
+
+
+// Asynchronous logger.
+// Each thread formats its messages directly in its own ring buffer,
+// without any lock, allocation or system call. A background thread drains
+// the rings, and writes the messages in time order: ERROR and WARNING
+// messages on the standard error, others on the standard output.
+// The background thread is woken up when a ring is a quarter full, or
+// when an ERROR or WARNING message is logged; otherwise it drains the
+// rings every MAX_LATENCY_MS milliseconds.
+// When the ring of a thread is full, its INFO, DEBUG and TRACE messages
+// are dropped instead of blocking the thread; the number of dropped
+// messages is displayed. ERROR and WARNING messages are then written
+// synchronously.
+// When a thread exits, its ring is given to the next thread that logs.
+// Threads that log while MAX_NB_THREADS other threads have a ring write
+// their messages synchronously.
+// Messages longer than MAX_MESSAGE_LENGTH characters are truncated.
+class Logger
+{
+public:
+    static constexpr size_t MAX_MESSAGE_LENGTH = 200;
+    static constexpr size_t RING_SIZE = 1024;       // Messages per thread, power of 2
+    static constexpr size_t MAX_NB_THREADS = 256;   // Rings, reused when threads exit
+    static constexpr size_t WAKE_THRESHOLD = RING_SIZE / 4;  // Messages in a ring that wake up the writer
+    static constexpr int MAX_LATENCY_MS = 100;      // Longest wait of the writer when not woken up
+
+private:
+    class Record
+    {
+    public:
+        double _time;           // Time of the message, to write messages of all threads in order
+        LogLevel _level;
+        uint32_t _length;
+        char _text[MAX_MESSAGE_LENGTH];
+    };
+
+    // Single producer (the thread), single consumer (the writer).
+    class Ring
+    {
+    public:
+        std::unique_ptr<Record[]> _records;
+        std::atomic<size_t> _head;      // Next record written by the producer
+        std::atomic<size_t> _tail;      // Next record read by the consumer
+        std::atomic<size_t> _nbDropped;
+        std::atomic<bool> _inUse;       // False when its thread has exited
+
+        Ring()
+          : _records(new Record[RING_SIZE]),
+            _head(0),
+            _tail(0),
+            _nbDropped(0),
+            _inUse(true)
+        {}
+    };
+
+    // Formats a message in a fixed buffer. Characters beyond the end of
+    // the buffer are dropped.
+    class MessageBuffer : public std::streambuf
+    {
+    public:
+        void reset(char* text) { setp(text, text + MAX_MESSAGE_LENGTH); }
+        size_t getLength() const { return size_t(pptr() - pbase()); }
+
+    protected:
+        int_type overflow(int_type c) override { return traits_type::not_eof(c); }
+    };
+
+    // Logging state of a thread. Gives the ring back when the thread exits.
+    class LocalState
+    {
+    public:
+        bool _registered;
+        Ring* _ring;            // Null if no ring was available
+        MessageBuffer _buffer;
+        std::ostream _stream;   // Writes in _buffer
+        Record* _record;        // Record of the message being formatted
+        Record _scratch;        // Message that does not fit in the ring
+
+        LocalState()
+          : _registered(false),
+            _ring(nullptr),
+            _buffer(),
+            _stream(&_buffer),
+            _record(nullptr)
+        {}
+        ~LocalState();
+    };
+
+    static std::atomic<int> _level;
+
+    std::unique_ptr<std::atomic<Ring*>[]> _rings;   // Indexed by order of first message
+    std::atomic<size_t> _nbRings;
+    std::mutex _drainMutex;         // Only one consumer at a time
+    std::vector<Record> _drained;   // Records copied by drain(), protected by _drainMutex
+    std::mutex _writerMutex;        // Protects _stopWriter
+    std::condition_variable _writerCond;
+    bool _stopWriter;
+    std::atomic<bool> _wakeRequested;   // Set by log() to wake up the writer
+    std::thread _writer;
+
+    explicit Logger();
+    ~Logger();
+
+    static Logger& getInstance();
+    static LocalState& getLocalState();
+    // Ring of a thread that exited, or a new ring. Null if there are
+    // already MAX_NB_THREADS rings in use.
+    Ring* acquireRing();
+    // Write record at once, after the messages logged so far.
+    void writeSynchronously(const Record& record);
+    // Make the writer drain the rings now, instead of at its next period.
+    void wakeWriter();
+    void drain();
+    void writerLoop();
+
+public:
+    // Runtime level: messages with a higher level are ignored.
+    // INFO by default.
+    static void setLevel(const LogLevel level) { _level.store(int(level), std::memory_order_relaxed); }
+    static LogLevel getLevel() { return LogLevel(_level.load(std::memory_order_relaxed)); }
+    static bool isEnabled(const LogLevel level) { return int(level) <= _level.load(std::memory_order_relaxed); }
+
+    // Stream of the current thread, used by LOG_MESSAGE to format a
+    // message in the next record of its ring.
+    static std::ostream& startMessage();
+    // Publish the message formatted since startMessage().
+    static void log(const LogLevel level);
+
+    // Write all messages logged so far. E.g. before writing directly
+    // on the standard output.
+    static void flush();
+};
+
+
+#endif // __LOGGER_HPP__
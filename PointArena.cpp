@@ -0,0 +1,113 @@
+#include "PointArena.hpp"
+
+#include <algorithm>    // For copy
+#include <memory>       // For unique_ptr
+#include <stdexcept>    // For length_error, invalid_argument
+#include <string>       // For to_string
+
+
+PointArena::PointArena(const size_t dimension)
+  : _dimension(dimension),
+    _chunks(new std::atomic<Slot*>[MAX_NB_CHUNKS]),
+    _coordChunks(new double*[MAX_NB_CHUNKS]),
+    _nbSlots(0),
+    _freeSlots(),
+    _nbPoints(0),
+    _lock()
+{
+    for (uint32_t i = 0; i < MAX_NB_CHUNKS; i++)
+    {
+        _chunks[i] = nullptr;
+        _coordChunks[i] = nullptr;
+    }
+    omp_init_lock(&_lock);
+}
+
+
+PointArena::~PointArena()
+{
+    for (uint32_t i = 0; i < MAX_NB_CHUNKS; i++)
+    {
+        delete [] _chunks[i].load();
+        delete [] _coordChunks[i];
+    }
+    omp_destroy_lock(&_lock);
+}
+
+
+QueuePointHandle PointArena::create(const QueuePoint& point)
+{
+    if (point.getDimension() != _dimension || (_dimension > 0 && nullptr == point.getCoords()))
+    {
+        throw std::invalid_argument("PointArena: point of dimension " + std::to_string(point.getDimension())
+                                    + " in arena of dimension " + std::to_string(_dimension));
+    }
+
+    uint32_t index;
+
+    omp_set_lock(&_lock);
+    if (!_freeSlots.empty())
+    {
+        index = _freeSlots.back();
+        _freeSlots.pop_back();
+    }
+    else
+    {
+        if (_nbSlots == MAX_NB_CHUNKS * CHUNK_SIZE)
+        {
+            omp_unset_lock(&_lock);
+            throw std::length_error("PointArena: maximum number of points reached");
+        }
+        index = _nbSlots++;
+        const uint32_t chunkIndex = index >> CHUNK_SIZE_LOG2;
+        if (nullptr == _chunks[chunkIndex].load(std::memory_order_relaxed))
+        {
+            // The lock must be released if the allocation fails.
+            std::unique_ptr<double[]> coordChunk;
+            std::unique_ptr<Slot[]> chunk;
+            try
+            {
+                coordChunk.reset(new double[size_t(CHUNK_SIZE) * _dimension]);
+                chunk.reset(new Slot[CHUNK_SIZE]);
+            }
+            catch (...)
+            {
+                _nbSlots--;
+                omp_unset_lock(&_lock);
+                throw;
+            }
+            _coordChunks[chunkIndex] = coordChunk.release();
+            _chunks[chunkIndex].store(chunk.release(), std::memory_order_release);
+        }
+    }
+    omp_unset_lock(&_lock);
+
+    // The slot belongs to this thread until the handle is returned.
+    Slot& slot = getSlot(index);
+    double* coords = getCoordsOfSlot(index);
+    std::copy(point.getCoords(), point.getCoords() + _dimension, coords);
+    slot._point = point;
+    slot._point.setCoords(coords);
+    _nbPoints++;
+
+    return QueuePointHandle(index, slot._generation);
+}
+
+
+bool PointArena::release(const QueuePointHandle& handle)
+{
+    bool released = false;
+
+    omp_set_lock(&_lock);
+    if (isValid(handle))
+    {
+        // Invalidate all handles to this slot.
+        getSlot(handle.getIndex())._generation++;
+        _freeSlots.push_back(handle.getIndex());
+        _nbPoints--;
+        released = true;
+    }
+    omp_unset_lock(&_lock);
+
+    return released;
+}
@@ -0,0 +1,95 @@
+#ifndef __POINTARENA_HPP__
+#define __POINTARENA_HPP__
+
+#include <atomic>
+#include <memory>
+#include <vector>
+
+#include "QueuePoint.hpp"
+
+// Storage for QueuePoints.
+// Points are stored by value in fixed-size chunks that are never moved,
+// so a point can be accessed from its handle by any thread while other
+// threads create points. Released slots are reused; their generation is
+// incremented so that stale handles are detected.
+// All points have the same dimension. The coordinates of the points of a
+// chunk are stored in a single contiguous block, point after point.
+class PointArena
+{
+private:
+    static const uint32_t CHUNK_SIZE_LOG2 = 12;    // 4096 points per chunk
+    static const uint32_t CHUNK_SIZE = 1u << CHUNK_SIZE_LOG2;
+    static const uint32_t MAX_NB_CHUNKS = 1u << 16;    // Up to 2^28 points
+
+    class Slot
+    {
+    public:
+        QueuePoint _point;
+        std::atomic<uint32_t> _generation;
+
+        Slot()
+          : _point(),
+            _generation(0)
+        {}
+    };
+
+    size_t _dimension;
+    std::unique_ptr<std::atomic<Slot*>[]> _chunks;
+    std::unique_ptr<double*[]> _coordChunks;    // Coordinates of the points of each chunk. Set before the chunk is published in _chunks.
+    uint32_t _nbSlots;                  // Number of slots ever used
+    std::vector<uint32_t> _freeSlots;   // Released slots, available for new points
+    std::atomic<size_t> _nbPoints;      // Number of live points
+    mutable omp_lock_t _lock;           // Protects _nbSlots, _freeSlots and chunk allocation
+
+    Slot& getSlot(const uint32_t index) const
+    {
+        Slot* chunk = _chunks[index >> CHUNK_SIZE_LOG2].load(std::memory_order_acquire);
+        return chunk[index & (CHUNK_SIZE - 1)];
+    }
+
+    double* getCoordsOfSlot(const uint32_t index) const
+    {
+        return _coordChunks[index >> CHUNK_SIZE_LOG2] + size_t(index & (CHUNK_SIZE - 1)) * _dimension;
+    }
+
+public:
+    // Constructor
+    explicit PointArena(const size_t dimension = 2);
+
+    // Destructor
+    virtual ~PointArena();
+
+    // The chunks and the lock cannot be copied.
+    PointArena(const PointArena&) = delete;
+    PointArena& operator=(const PointArena&) = delete;
+
+    // Get/Set
+    size_t getNbPoints() const { return _nbPoints; }
+    size_t getDimension() const { return _dimension; }
+
+    // Store a copy of point, with a copy of its coordinates, and return
+    // its handle. Thread-safe.
+    // Throws std::invalid_argument if the dimension of the point is not
+    // the dimension of the arena.
+    QueuePointHandle create(const QueuePoint& point);
+
+    // Release the point: its slot may be reused. Thread-safe.
+    // Return false if the handle was already invalid.
+    bool release(const QueuePointHandle& handle);
+
+    // Is the handle referring to a live point?
+    bool isValid(const QueuePointHandle& handle) const
+    {
+        return (!handle.isNull()
+                && handle.getIndex() < MAX_NB_CHUNKS * CHUNK_SIZE
+                && nullptr != _chunks[handle.getIndex() >> CHUNK_SIZE_LOG2].load(std::memory_order_acquire)
+                && getSlot(handle.getIndex())._generation == handle.getGeneration());
+    }
+
+    // Access the point. The handle must be valid.
+    QueuePoint& get(const QueuePointHandle& handle) { return getSlot(handle.getIndex())._point; }
+    const QueuePoint& get(const QueuePointHandle& handle) const { return getSlot(handle.getIndex())._point; }
+};
+
+
+#endif // __POINTARENA_HPP__
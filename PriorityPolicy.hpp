@@ -0,0 +1,160 @@
+#ifndef __PRIORITYPOLICY_HPP__
+#define __PRIORITYPOLICY_HPP__
+
+#include <stdexcept>    // For invalid_argument
+#include <string>       // For to_string
+#include <vector>
+
+#include "QueuePoint.hpp"
+
+// Compile-time priority policies, used with StaticLowerPriority.
+// Contrary to LowerPriority, there is no std::function: the queue
+// calls the policy directly, so it can be inlined in the heap operations.
+//
+// A policy provides:
+// - static const bool useCost: If true, the queue orders points by keys
+//   computed once from costs(). If false, comp() is called at each
+//   comparison.
+// - void costs(const PointBatch& batch, double* costs) const: Cost of each
+//   point of the batch. The lower the cost, the higher the priority.
+// - bool comp(const QueuePoint& p1, const QueuePoint& p2) const: True if
+//   p1 has a lower priority than p2. P1 flags are already taken care of.
+//   It must not throw: it is called in the middle of heap operations.
+// - void checkDimension(const size_t dimension) const: Throws
+//   std::invalid_argument if the policy cannot order points of this
+//   dimension. The queue calls it when points are added.
+
+
+// Priority is lower if best evaluation is higher.
+// Same ordering as LowerPriority::DefaultComp.
+class DefaultPriority
+{
+public:
+    static const bool useCost = true;
+
+    void costs(const PointBatch& batch, double* costs) const
+    {
+        LowerPriority::DefaultCost(batch, costs);
+    }
+
+    bool comp(const QueuePoint& p1, const QueuePoint& p2) const
+    {
+        return (p1.getBestEval() > p2.getBestEval());
+    }
+
+    // Any dimension.
+    void checkDimension(const size_t) const {}
+};
+
+
+// Points that are closest to a direction have a higher priority.
+// The direction has the dimension of the points, or is empty: then it is
+// the origin, and the cost is the squared norm of the point.
+class DirectionPriority
+{
+private:
+    std::vector<double> _direction;
+
+    double squaredDistanceToDirection(const double* x, const size_t dimension) const
+    {
+        return _direction.empty() ? dot(x, x, dimension)
+                                  : squaredDistance(x, _direction.data(), dimension);
+    }
+
+public:
+    static const bool useCost = true;
+
+    explicit DirectionPriority(const std::vector<double>& direction = std::vector<double>())
+      : _direction(direction)
+    {}
+
+    // Get/Set
+    const std::vector<double>& getDirection() const { return _direction; }
+
+    // Throws std::invalid_argument if the direction is not of the
+    // dimension of the points.
+    void checkDimension(const size_t dimension) const
+    {
+        if (!_direction.empty() && _direction.size() != dimension)
+        {
+            throw std::invalid_argument("DirectionPriority: direction of dimension " + std::to_string(_direction.size())
+                                        + " for points of dimension " + std::to_string(dimension));
+        }
+    }
+
+    // The cost is the square distance to the direction.
+    void costs(const PointBatch& batch, double* costs) const
+    {
+        const size_t n = batch.size();
+        const size_t dimension = batch.getDimension();
+        checkDimension(dimension);
+        for (size_t i = 0; i < n; i++)
+        {
+            costs[i] = squaredDistanceToDirection(batch.getCoords(i), dimension);
+        }
+    }
+
+    // The point farthest from the direction gets lower priority.
+    // The dimension of the points is checked when they are added.
+    bool comp(const QueuePoint& p1, const QueuePoint& p2) const
+    {
+        return (squaredDistanceToDirection(p1.getCoords(), p1.getDimension())
+                > squaredDistanceToDirection(p2.getCoords(), p2.getDimension()));
+    }
+};
+
+
+// Order with the comparison function of Policy at each comparison,
+// instead of precomputed keys.
+template <typename Policy>
+class CompOnly : public Policy
+{
+public:
+    static const bool useCost = false;
+
+    using Policy::Policy;
+
+    CompOnly(const Policy& policy = Policy())
+      : Policy(policy)
+    {}
+};
+
+
+// Same interface as LowerPriority, with the policy known at compile time.
+template <typename Policy>
+class StaticLowerPriority
+{
+private:
+    Policy _policy;
+
+public:
+    // Constructor
+    explicit StaticLowerPriority(const Policy& policy = Policy())
+      : _policy(policy)
+    {}
+
+    // Get/Set
+    const Policy& getPolicy() const { return _policy; }
+    bool hasCost() const { return Policy::useCost; }
+
+    // Compute the costs of the points of batch. hasCost() must be true.
+    void computeCosts(const PointBatch& batch, double* costs) const { _policy.costs(batch, costs); }
+
+    // Throws std::invalid_argument if points of this dimension cannot be
+    // ordered.
+    void checkDimension(const size_t dimension) const { _policy.checkDimension(dimension); }
+
+    // Comparison operator for sorting queue points.
+    // Points P1 are always prioritary.
+    bool operator()(const QueuePoint& p1, const QueuePoint& p2) const
+    {
+        if (p1.getP1() != p2.getP1())
+        {
+            return (p1.getP1() < p2.getP1());
+        }
+        return _policy.comp(p1, p2);
+    }
+};
+
+
+#endif // __PRIORITYPOLICY_HPP__
@@ -0,0 +1,505 @@
+#include "ProcessEvaluator.hpp"
+
+#include <algorithm>    // For min, max
+#include <cerrno>
+#include <chrono>
+#include <cmath>        // For ceil
+#include <csignal>      // For signal, kill, SIGPIPE, SIGKILL
+#include <cstdint>      // For uint32_t
+#include <cstring>      // For memcpy, strerror
+#include <limits>       // For quiet_NaN
+#include <stdexcept>    // For runtime_error
+
+#include <fcntl.h>      // For O_CLOEXEC
+#include <omp.h>        // For omp_get_wtime
+#include <sys/wait.h>   // For waitpid
+#include <unistd.h>     // For pipe2, fork, execvp, read, write, close
+
+#include "Logger.hpp"
+#include "Threading.hpp"
+
+
+// Evaluation of the points of a batch that could not be evaluated.
+static const double FAILED_EVAL = std::numeric_limits<double>::quiet_NaN();
+// Longest wait in poll() for a reply, when requests also wait for a
+// worker to be released by another thread.
+static const double FREE_WORKER_POLL_INTERVAL = 0.001;     // Seconds
+
+
+// Write or read all size bytes, retrying on partial transfers.
+// Return false if the pipe is closed or broken, or, for readAll(), if
+// timeout seconds passed (no timeout if 0).
+static bool writeAll(const int fd, const char* data, size_t size)
+{
+    while (size > 0)
+    {
+        ssize_t nbBytes = write(fd, data, size);
+        if (nbBytes < 0 && EINTR == errno)
+        {
+            continue;
+        }
+        if (nbBytes <= 0)
+        {
+            return false;
+        }
+        data += nbBytes;
+        size -= size_t(nbBytes);
+    }
+    return true;
+}
+
+
+static bool readAll(const int fd, char* data, size_t size, const double timeout)
+{
+    const double endTime = omp_get_wtime() + timeout;
+    while (size > 0)
+    {
+        if (timeout > 0.0)
+        {
+            struct pollfd pollFd;
+            pollFd.fd = fd;
+            pollFd.events = POLLIN;
+            pollFd.revents = 0;
+            const int timeoutMs = int(std::ceil(std::max(0.0, endTime - omp_get_wtime()) * 1000));
+            const int nbReady = ::poll(&pollFd, 1, timeoutMs);
+            if (nbReady < 0 && EINTR == errno)
+            {
+                continue;
+            }
+            if (nbReady <= 0)
+            {
+                return false;
+            }
+        }
+        ssize_t nbBytes = read(fd, data, size);
+        if (nbBytes < 0 && EINTR == errno)
+        {
+            continue;
+        }
+        if (nbBytes <= 0)
+        {
+            return false;
+        }
+        data += nbBytes;
+        size -= size_t(nbBytes);
+    }
+    return true;
+}
+
+
+ProcessEvaluator::ProcessEvaluator(const std::vector<std::string>& command,
+                                   const size_t nbWorkers,
+                                   const double replyTimeout)
+  : _command(command),
+    _replyTimeout(replyTimeout),
+    _workers(),
+    _freeWorkers(),
+    _mutex(),
+    _freeCond(),
+    _nbThreads(Threading::getMaxThreads()),
+    _threadStates(new ThreadState[_nbThreads])
+{
+    if (_command.empty())
+    {
+        throw std::runtime_error("ProcessEvaluator: empty worker command");
+    }
+    std::signal(SIGPIPE, SIG_IGN);
+
+    const size_t nbProcesses = (nbWorkers > 0) ? nbWorkers : size_t(Threading::getMaxThreads());
+    for (size_t i = 0; i < nbProcesses; i++)
+    {
+        _workers.push_back(std::unique_ptr<WorkerProcess>(new WorkerProcess()));
+        startWorker(*_workers.back());
+        _freeWorkers.push_back(_workers.back().get());
+    }
+}
+
+
+ProcessEvaluator::~ProcessEvaluator()
+{
+    // Closing the standard input of the workers makes them exit.
+    for (auto& worker : _workers)
+    {
+        if (worker->_pid > 0)
+        {
+            close(worker->_toWorker);
+        }
+    }
+    for (auto& worker : _workers)
+    {
+        if (worker->_pid > 0)
+        {
+            close(worker->_fromWorker);
+            waitpid(worker->_pid, nullptr, 0);
+        }
+    }
+}
+
+
+void ProcessEvaluator::startWorker(WorkerProcess& worker) const
+{
+    // Pipes are closed on exec, so that each worker only inherits its own.
+    // The child writes to execStatus the errno of a failed exec; if the
+    // exec succeeds, the pipe is closed without being written to.
+    int toWorker[2];
+    int fromWorker[2];
+    int execStatus[2];
+    if (0 != pipe2(toWorker, O_CLOEXEC))
+    {
+        throw std::runtime_error(std::string("ProcessEvaluator: cannot create pipe: ") + std::strerror(errno));
+    }
+    if (0 != pipe2(fromWorker, O_CLOEXEC))
+    {
+        const int error = errno;
+        close(toWorker[0]);
+        close(toWorker[1]);
+        throw std::runtime_error(std::string("ProcessEvaluator: cannot create pipe: ") + std::strerror(error));
+    }
+    if (0 != pipe2(execStatus, O_CLOEXEC))
+    {
+        const int error = errno;
+        close(toWorker[0]);
+        close(toWorker[1]);
+        close(fromWorker[0]);
+        close(fromWorker[1]);
+        throw std::runtime_error(std::string("ProcessEvaluator: cannot create pipe: ") + std::strerror(error));
+    }
+
+    // Prepare the arguments before forking: only async-signal-safe
+    // functions may be called in the child.
+    std::vector<char*> argv;
+    for (const auto& arg : _command)
+    {
+        argv.push_back(const_cast<char*>(arg.c_str()));
+    }
+    argv.push_back(nullptr);
+
+    pid_t pid = fork();
+    if (0 == pid)
+    {
+        // Child: dup2() clears the close-on-exec flag of the copies.
+        dup2(toWorker[0], STDIN_FILENO);
+        dup2(fromWorker[1], STDOUT_FILENO);
+        execvp(argv[0], argv.data());
+        const int error = errno;
+        ssize_t nbBytes = write(execStatus[1], &error, sizeof(error));
+        (void)nbBytes;
+        _exit(127);
+    }
+
+    const int forkError = errno;
+    close(toWorker[0]);
+    close(fromWorker[1]);
+    close(execStatus[1]);
+    if (pid < 0)
+    {
+        close(toWorker[1]);
+        close(fromWorker[0]);
+        close(execStatus[0]);
+        throw std::runtime_error(std::string("ProcessEvaluator: cannot start worker: ") + std::strerror(forkError));
+    }
+
+    // Wait for the exec.
+    int execError = 0;
+    ssize_t nbBytes;
+    do
+    {
+        nbBytes = read(execStatus[0], &execError, sizeof(execError));
+    } while (nbBytes < 0 && EINTR == errno);
+    close(execStatus[0]);
+    if (sizeof(execError) == size_t(nbBytes))
+    {
+        close(toWorker[1]);
+        close(fromWorker[0]);
+        waitpid(pid, nullptr, 0);
+        throw std::runtime_error("ProcessEvaluator: cannot run " + _command[0] + ": " + std::strerror(execError));
+    }
+
+    worker._pid = pid;
+    worker._toWorker = toWorker[1];
+    worker._fromWorker = fromWorker[0];
+}
+
+
+void ProcessEvaluator::restartWorker(WorkerProcess& worker) const
+{
+    if (worker._pid > 0)
+    {
+        LOG_WARNING("ProcessEvaluator: worker " << worker._pid << " did not reply, start a new worker.");
+        close(worker._toWorker);
+        close(worker._fromWorker);
+        kill(worker._pid, SIGKILL);
+        waitpid(worker._pid, nullptr, 0);
+        worker._pid = -1;
+    }
+
+    try
+    {
+        startWorker(worker);
+    }
+    catch (const std::runtime_error& e)
+    {
+        LOG_ERROR(e.what());
+    }
+}
+
+
+ProcessEvaluator::WorkerProcess& ProcessEvaluator::acquireWorker() const
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+    _freeCond.wait(lock, [this]{ return !_freeWorkers.empty(); });
+    WorkerProcess* worker = _freeWorkers.back();
+    _freeWorkers.pop_back();
+    return *worker;
+}
+
+
+ProcessEvaluator::WorkerProcess* ProcessEvaluator::tryAcquireWorker() const
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    if (_freeWorkers.empty())
+    {
+        return nullptr;
+    }
+    WorkerProcess* worker = _freeWorkers.back();
+    _freeWorkers.pop_back();
+    return worker;
+}
+
+
+void ProcessEvaluator::releaseWorker(WorkerProcess& worker) const
+{
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _freeWorkers.push_back(&worker);
+    }
+    // Threads in eval() and in poll() wait for free workers.
+    _freeCond.notify_all();
+}
+
+
+void ProcessEvaluator::writeRequest(const PointBatch& batch, std::vector<char>& buffer)
+{
+    // The whole request is written at once.
+    // The coordinates of the batch are already contiguous.
+    const uint32_t header[2] = { uint32_t(batch.size()), uint32_t(batch.getDimension()) };
+    const size_t coordsSize = batch.size() * batch.getDimension() * sizeof(double);
+    buffer.resize(sizeof(header) + coordsSize);
+    std::memcpy(buffer.data(), header, sizeof(header));
+    std::memcpy(buffer.data() + sizeof(header), batch.getCoords(), coordsSize);
+}
+
+
+void ProcessEvaluator::eval(const PointBatch& batch, double* evals) const
+{
+    const size_t n = batch.size();
+    if (0 == n)
+    {
+        return;
+    }
+
+    WorkerLease lease(*this, acquireWorker());
+    WorkerProcess& worker = lease._worker;
+    if (worker._pid < 0)
+    {
+        restartWorker(worker);
+    }
+
+    writeRequest(batch, worker._buffer);
+    bool ok = (worker._pid > 0)
+              && writeAll(worker._toWorker, worker._buffer.data(), worker._buffer.size())
+              && readAll(worker._fromWorker, reinterpret_cast<char*>(evals), n * sizeof(double), _replyTimeout);
+    if (!ok)
+    {
+        // The worker is dead, out of sync, or did not reply in time.
+        restartWorker(worker);
+        std::fill(evals, evals + n, FAILED_EVAL);
+    }
+}
+
+
+bool ProcessEvaluator::startRequest(AsyncRequest& request) const
+{
+    request._worker = tryAcquireWorker();
+    if (nullptr == request._worker)
+    {
+        return false;
+    }
+    if (request._worker->_pid < 0)
+    {
+        restartWorker(*request._worker);
+    }
+
+    // The request fits in the pipe buffer, or the worker reads it at once:
+    // the write does not wait for the evaluations.
+    request._startTime = omp_get_wtime();
+    if (request._worker->_pid < 0
+        || !writeAll(request._worker->_toWorker, request._buffer.data(), request._buffer.size()))
+    {
+        failRequest(request);
+    }
+    return true;
+}
+
+
+void ProcessEvaluator::failRequest(AsyncRequest& request) const
+{
+    restartWorker(*request._worker);
+    releaseWorker(*request._worker);
+    request._worker = nullptr;
+    request._failed = true;
+    std::fill(request._evals.begin(), request._evals.end(), FAILED_EVAL);
+}
+
+
+void ProcessEvaluator::submit(const PointBatch& batch, const uint64_t* tags)
+{
+    if (0 == batch.size())
+    {
+        return;
+    }
+
+    ThreadState& state = _threadStates[Threading::getThreadNum() % _nbThreads];
+    state._requests.emplace_back();
+    AsyncRequest& request = state._requests.back();
+    request._worker = nullptr;
+    writeRequest(batch, request._buffer);
+    request._tags.assign(tags, tags + batch.size());
+    request._evals.resize(batch.size());
+    request._nbBytesRead = 0;
+    request._failed = false;
+
+    // If no worker is free, poll() starts the request.
+    startRequest(request);
+}
+
+
+size_t ProcessEvaluator::poll(std::vector<AsyncResult>& results, const double timeout)
+{
+    ThreadState& state = _threadStates[Threading::getThreadNum() % _nbThreads];
+    const double endTime = omp_get_wtime() + timeout;
+    size_t nbResults = 0;
+    while (!state._requests.empty())
+    {
+        // Start the requests waiting for a worker, and wait for the replies.
+        state._pollFds.clear();
+        state._polled.clear();
+        bool isWaitingForWorker = false;
+        double replyEndTime = endTime;     // Of the first request to time out
+        for (size_t i = 0; i < state._requests.size(); i++)
+        {
+            AsyncRequest& request = state._requests[i];
+            if (!request._failed && nullptr == request._worker && !startRequest(request))
+            {
+                isWaitingForWorker = true;
+            }
+            if (nullptr != request._worker)
+            {
+                struct pollfd pollFd;
+                pollFd.fd = request._worker->_fromWorker;
+                pollFd.events = POLLIN;
+                pollFd.revents = 0;
+                state._pollFds.push_back(pollFd);
+                state._polled.push_back(i);
+                if (_replyTimeout > 0.0)
+                {
+                    replyEndTime = std::min(replyEndTime, request._startTime + _replyTimeout);
+                }
+            }
+        }
+
+        const double waitTime = std::max(0.0, endTime - omp_get_wtime());
+        if (!state._pollFds.empty())
+        {
+            // Read only what is ready: read() returns at once after POLLIN.
+            // Wake up for the first reply timeout, and, if requests wait for
+            // a worker, to check for free workers.
+            double pollTime = std::min(waitTime, std::max(0.0, replyEndTime - omp_get_wtime()));
+            if (isWaitingForWorker)
+            {
+                pollTime = std::min(pollTime, FREE_WORKER_POLL_INTERVAL);
+            }
+            const int timeoutMs = int(std::ceil(pollTime * 1000));
+            if (::poll(state._pollFds.data(), state._pollFds.size(), timeoutMs) < 0 && EINTR != errno)
+            {
+                LOG_ERROR("ProcessEvaluator: poll failed: " << std::strerror(errno));
+            }
+            for (size_t i = 0; i < state._pollFds.size(); i++)
+            {
+                if (0 == state._pollFds[i].revents)
+                {
+                    continue;
+                }
+                AsyncRequest& request = state._requests[state._polled[i]];
+                const size_t replySize = request._evals.size() * sizeof(double);
+                ssize_t nbBytes = read(request._worker->_fromWorker,
+                                       reinterpret_cast<char*>(request._evals.data()) + request._nbBytesRead,
+                                       replySize - request._nbBytesRead);
+                if (nbBytes > 0)
+                {
+                    request._nbBytesRead += size_t(nbBytes);
+                    if (request._nbBytesRead == replySize)
+                    {
+                        releaseWorker(*request._worker);
+                        request._worker = nullptr;
+                    }
+                }
+                else if (0 == nbBytes || EINTR != errno)
+                {
+                    failRequest(request);
+                }
+            }
+
+            // Workers that did not reply in time are restarted.
+            if (_replyTimeout > 0.0)
+            {
+                const double now = omp_get_wtime();
+                for (const size_t i : state._polled)
+                {
+                    AsyncRequest& request = state._requests[i];
+                    if (nullptr != request._worker && now - request._startTime >= _replyTimeout)
+                    {
+                        failRequest(request);
+                    }
+                }
+            }
+        }
+        else if (waitTime > 0.0)
+        {
+            // All workers are busy with the requests of other threads.
+            std::unique_lock<std::mutex> lock(_mutex);
+            _freeCond.wait_for(lock, std::chrono::duration<double>(waitTime),
+                               [this]{ return !_freeWorkers.empty(); });
+        }
+
+        // Requests that are done: not waiting for a worker, nor for a reply.
+        for (size_t i = 0; i < state._requests.size(); )
+        {
+            AsyncRequest& request = state._requests[i];
+            const bool isDone = request._failed
+                                || (nullptr == request._worker && request._nbBytesRead == request._evals.size() * sizeof(double));
+            if (!isDone)
+            {
+                i++;
+                continue;
+            }
+            for (size_t j = 0; j < request._tags.size(); j++)
+            {
+                AsyncResult result;
+                result._tag = request._tags[j];
+                result._eval = request._evals[j];
+                results.push_back(result);
+            }
+            nbResults += request._tags.size();
+            std::swap(request, state._requests.back());
+            state._requests.pop_back();
+        }
+
+        if (nbResults > 0 || omp_get_wtime() >= endTime)
+        {
+            break;
+        }
+    }
+
+    return nbResults;
+}
@@ -0,0 +1,150 @@
+#ifndef __PROCESSEVALUATOR_HPP__
+#define __PROCESSEVALUATOR_HPP__
+
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <poll.h>       // For pollfd
+#include <sys/types.h>  // For pid_t
+
+#include "Evaluator.hpp"
+
+// Evaluation by a pool of long-lived worker processes.
+// The workers are started once, when the evaluator is created, and are
+// given batches of points through pipes, so there is no process startup
+// for each evaluation. Each call to eval() takes a free worker, waiting
+// for one if needed, so several threads evaluate at the same time.
+// It is also an AsyncEvaluator: submit() writes the batch to a free worker
+// and returns, and poll() reads the replies that are ready, so a thread
+// keeps several workers busy.
+//
+// Protocol, in binary with the native byte order, on the worker's
+// standard input and output:
+//  Request: uint32_t n, uint32_t dimension, then the coordinates of the
+//  n points, as doubles, point after point.
+//  Reply: n doubles, the evaluations, in the same order.
+// A worker exits when its standard input is closed.
+// See evalworker.cpp for an example of worker.
+//
+// A worker that dies, or does not reply within the reply timeout, if one
+// is set, is killed and started again, and the points it was evaluating
+// get a failed evaluation: NaN. eval() is called in parallel regions, so
+// it does not throw.
+// SIGPIPE is ignored, so that writing to a dead worker fails instead of
+// killing the process.
+class ProcessEvaluator : public Evaluator, public AsyncEvaluator
+{
+private:
+    class WorkerProcess
+    {
+    public:
+        pid_t _pid;                 // -1 if the worker could not be started
+        int _toWorker;              // Write end of the worker's standard input
+        int _fromWorker;            // Read end of the worker's standard output
+        std::vector<char> _buffer;  // Request being written
+    };
+
+    // Give the worker back to the pool when it goes out of scope.
+    class WorkerLease
+    {
+    public:
+        const ProcessEvaluator& _evaluator;
+        WorkerProcess& _worker;
+
+        WorkerLease(const ProcessEvaluator& evaluator, WorkerProcess& worker)
+          : _evaluator(evaluator),
+            _worker(worker)
+        {}
+        ~WorkerLease() { _evaluator.releaseWorker(_worker); }
+
+        WorkerLease(const WorkerLease&) = delete;
+        WorkerLease& operator=(const WorkerLease&) = delete;
+    };
+
+    // Batch submitted by a thread.
+    class AsyncRequest
+    {
+    public:
+        WorkerProcess* _worker;     // Null while waiting for a free worker
+        std::vector<char> _buffer;  // Request to write
+        std::vector<uint64_t> _tags;
+        std::vector<double> _evals;
+        size_t _nbBytesRead;        // Of the reply
+        double _startTime;          // When the request was written to the worker
+        bool _failed;               // The worker died or timed out: evaluations failed
+    };
+
+    // Batches submitted by a thread and not done yet.
+    class alignas(64) ThreadState
+    {
+    public:
+        std::vector<AsyncRequest> _requests;
+        std::vector<struct pollfd> _pollFds;
+        std::vector<size_t> _polled;    // Index in _requests of each poll fd
+    };
+
+    std::vector<std::string> _command;  // Program and arguments of the workers
+    double _replyTimeout;               // In seconds, 0 for none
+    std::vector<std::unique_ptr<WorkerProcess>> _workers;
+    mutable std::vector<WorkerProcess*> _freeWorkers;
+    mutable std::mutex _mutex;          // Protects _freeWorkers
+    mutable std::condition_variable _freeCond;  // Notified when a worker is released
+    size_t _nbThreads;
+    std::unique_ptr<ThreadState[]> _threadStates;   // Indexed by thread number modulo _nbThreads
+
+    // Throws std::runtime_error if the worker cannot be started, or if its
+    // command cannot be run.
+    void startWorker(WorkerProcess& worker) const;
+    // Kill the worker if it is still running, and start a new one.
+    // If it cannot be started, its _pid is -1: it is started again the
+    // next time it is used.
+    void restartWorker(WorkerProcess& worker) const;
+    WorkerProcess& acquireWorker() const;
+    // Return null if no worker is free.
+    WorkerProcess* tryAcquireWorker() const;
+    void releaseWorker(WorkerProcess& worker) const;
+
+    // Write in buffer the request to evaluate batch.
+    static void writeRequest(const PointBatch& batch, std::vector<char>& buffer);
+    // Give a free worker to request, and write the request to it.
+    // Return false if no worker is free.
+    bool startRequest(AsyncRequest& request) const;
+    // The worker of request died or timed out: restart it, and fail the
+    // evaluations.
+    void failRequest(AsyncRequest& request) const;
+
+public:
+    // Constructor. Start nbWorkers processes running command: the path to
+    // the program, followed by its arguments. If nbWorkers is 0, start one
+    // per thread. A worker that does not reply to a request within
+    // replyTimeout seconds is restarted; 0 waits forever.
+    // Throws std::runtime_error if a worker cannot be started, e.g. if the
+    // command cannot be run.
+    explicit ProcessEvaluator(const std::vector<std::string>& command,
+                              const size_t nbWorkers = 0,
+                              const double replyTimeout = 0.0);
+
+    // Destructor. Close the pipes and wait for the workers to exit.
+    virtual ~ProcessEvaluator();
+
+    // Workers cannot be shared.
+    ProcessEvaluator(const ProcessEvaluator&) = delete;
+    ProcessEvaluator& operator=(const ProcessEvaluator&) = delete;
+
+    // Get/Set
+    size_t getNbWorkers() const { return _workers.size(); }
+    double getReplyTimeout() const { return _replyTimeout; }
+
+    void eval(const PointBatch& batch, double* evals) const override;
+
+    // Asynchronous evaluation. A batch waits in poll() for a free worker
+    // if none is free when it is submitted.
+    void submit(const PointBatch& batch, const uint64_t* tags) override;
+    size_t poll(std::vector<AsyncResult>& results, const double timeout) override;
+};
+
+
+#endif // __PROCESSEVALUATOR_HPP__
@@ -1,300 +1,1557 @@
 #include "Queue.hpp"
 
-#include <algorithm>    // For sort
-#include <unistd.h>     // For usleep
+#include <algorithm>    // For min, max, sort, count_if, any_of, lexicographical_compare
+#include <chrono>
+#include <cmath>        // For isnan
+#include <random>       // For minstd_rand
+#include <stdexcept>    // For invalid_argument
+#include <string>       // For to_string
+#include <thread>       // For sleep_for
+#include <unordered_set>
 
-omp_lock_t _queueLock;
+// Points added by the current thread since startAdding(), with their
+// key not computed yet. A thread adds points to one queue at a time.
+static thread_local std::vector<QueueEntry> addedEntries;
+// Is the current thread between startAdding() and stopAdding()?
+static thread_local bool isAdding = false;
+
+// Random index in [0, n), with one generator per thread.
+static size_t randomIndex(const size_t n)
+{
+    static thread_local std::minstd_rand generator(std::random_device{}() + Threading::getThreadNum());
+    return generator() % n;
+}
+
+
+template <typename Priority>
+SubQueue& BasicQueue<Priority>::getOwnSubQueue() const
+{
+    // For LOCKED backend, there is a single SubQueue.
+    return *_subQueues[Threading::getThreadNum() % _subQueues.size()];
+}
+
+
+template <typename Priority>
+void BasicQueue<Priority>::updatePreferredSubQueues()
+{
+    // Main threads pop from their own SubQueue. Other threads are
+    // distributed evenly among main threads.
+    const size_t nbSubQueues = _subQueues.size();
+    std::vector<int> mainThreads = getMainThreads();
+    for (size_t i = 0; i < nbSubQueues; i++)
+    {
+        if (isMainThread(int(i)) || mainThreads.empty())
+        {
+            _preferredSubQueue[i] = int(i);
+        }
+        else
+        {
+            _preferredSubQueue[i] = mainThreads[i % mainThreads.size()] % nbSubQueues;
+        }
+    }
+}
+
+
+template <typename Priority>
+bool BasicQueue<Priority>::addMainThread(const int threadNum)
+{
+    std::lock_guard<std::mutex> rolesLock(_rolesMutex);
+    if (isMainThread(threadNum))
+    {
+        return false;
+    }
+
+    // Once the last main thread is stopped, evaluation is done: the count
+    // never goes up from 0.
+    int nbMainThreads = _nbMainThreads;
+    do
+    {
+        if (0 == nbMainThreads)
+        {
+            return false;
+        }
+    } while (!_nbMainThreads.compare_exchange_weak(nbMainThreads, nbMainThreads + 1));
+
+    _isMain[threadNum % _nbOwners] = true;
+    updatePreferredSubQueues();
+
+    return true;
+}
+
+
+template <typename Priority>
+std::vector<int> BasicQueue<Priority>::getMainThreads() const
+{
+    std::vector<int> mainThreads;
+    for (size_t i = 0; i < _nbOwners; i++)
+    {
+        if (isMainThread(int(i)))
+        {
+            mainThreads.push_back(int(i));
+        }
+    }
+
+    return mainThreads;
+}
 
-const bool debugLock = false;
 
-void Queue::startAdding()
+template <typename Priority>
+void BasicQueue<Priority>::startAdding()
 {
-    if (debugLock) std::cout << "DEBUG: startAdding locks queue for thread " << omp_get_thread_num() << std::endl;
-    omp_set_lock(&_queueLock);
+    // Points are staged without any lock: the SubQueues are only locked
+    // by stopAdding(), to merge the staged points.
+    isAdding = true;
 }
 
 
 // Add a point to the Queue
-void Queue::addToQueue(const QueuePointPtr point)
+template <typename Priority>
+void BasicQueue<Priority>::addToQueue(const QueuePointHandle& handle)
 {
-    if (omp_test_lock(&_queueLock))
+    // Point already evaluated, or duplicate of a point already evaluated:
+    // no need to queue it.
+    if (evalFromCache(handle))
+    {
+        return;
+    }
+
+    if (!isAdding)
     {
-        std::cerr << "Warning, tring to add an element to a queue that was not locked." << std::endl;
+        LOG_WARNING("Warning, trying to add an element to the queue without calling startAdding().");
+        // Add the point now: stopAdding() may never be called.
+        std::vector<QueueEntry> entries(1, makeEntry(handle));
+        publish(entries);
+        notifyWaitingThreads();
+        return;
     }
-    _queue.push_back(point);
+
+    // The key is computed in stopAdding(), for all added points at once.
+    addedEntries.push_back(makeEntry(handle));
 }
 
 
-void Queue::stopAdding()
+template <typename Priority>
+void BasicQueue<Priority>::stopAdding()
 {
-    if (debugLock) std::cout << "DEBUG: stopAdding unlocks queue for thread " << omp_get_thread_num() << std::endl;
-    omp_unset_lock(&_queueLock);
-    // sort queue
-    sort();
+    try
+    {
+        publish(addedEntries);
+    }
+    catch (...)
+    {
+        // The points cannot be ordered, e.g. their dimension does not
+        // match the Priority: they are not added.
+        addedEntries.clear();
+        isAdding = false;
+        throw;
+    }
+    addedEntries.clear();
+    isAdding = false;
+
+    // New points are available.
+    notifyWaitingThreads();
 }
 
 
-QueuePointPtr Queue::getTopPoint() const
+template <typename Priority>
+void BasicQueue<Priority>::publish(std::vector<QueueEntry>& entries)
 {
-    QueuePointPtr retPoint = nullptr;
-    if (debugLock) std::cout << "DEBUG: getTopPoint locks queue for thread " << omp_get_thread_num() << std::endl;
-    omp_set_lock(&_queueLock);
-    if (!_queue.empty())
+    if (entries.empty())
+    {
+        return;
+    }
+
+    SubQueue* homeSubQueue = &getOwnSubQueue();
+    if (QueueBackend::MULTIQUEUE == _backend)
+    {
+        homeSubQueue = _subQueues[randomIndex(_subQueues.size())].get();
+    }
+
+    // Compute the keys and sort the entries without holding the lock,
+    // with a copy of _comp: sort() and rekey() may change _comp meanwhile,
+    // but only while holding all locks.
+    lockSubQueue(*homeSubQueue);
+    const Priority comp = _comp;
+    const uint64_t compVersion = _compVersion;
+    homeSubQueue->unlock();
+
+    const EntryPriority<Priority> entryComp(_arena, comp);
+    // From the highest to the lowest priority.
+    auto higherPriority = [&entryComp](const QueueEntry& e1, const QueueEntry& e2) { return entryComp(e2, e1); };
+    entryComp.computeKeys(entries);
+    std::sort(entries.begin(), entries.end(), higherPriority);
+
+    lockSubQueue(*homeSubQueue);
+    if (compVersion != _compVersion)
+    {
+        // _comp changed: the keys are out of date.
+        _entryComp.computeKeys(entries);
+        std::sort(entries.begin(), entries.end(),
+                  [this](const QueueEntry& e1, const QueueEntry& e2) { return _entryComp(e2, e1); });
+    }
+
+    // Update counters before the points are in the queue: a thread may
+    // pop them as soon as they are pushed, and decrement the counters.
+    // A positive count may then mean that a point is about to be pushed.
+    const int nbP1 = int(std::count_if(entries.begin(), entries.end(),
+                                       [](const QueueEntry& entry) { return entry.getP1(); }));
+    if (nbP1 > 0 && 0 == _nbP1.fetch_add(nbP1) && _stats.isEnabled())
     {
-        retPoint = _queue[_queue.size()-1];
+        _stats.startP1Phase();
+    }
+    _queueSize += int(entries.size());
+
+    size_t nbPushed = 0;
+    int nbP1Pushed = 0;
+    try
+    {
+        if (QueueBackend::MULTIQUEUE != _backend)
+        {
+            // A single merge, O(k log n) or O(n + k) for k entries.
+            homeSubQueue->merge(entries, _entryComp);
+            nbPushed = entries.size();
+            nbP1Pushed = nbP1;
+        }
+        else
+        {
+            for (const auto& entry : entries)
+            {
+                // Spread the points on random SubQueues. Locks are only tried,
+                // so there is no deadlock with the lock on homeSubQueue.
+                SubQueue& subQueue = *_subQueues[randomIndex(_subQueues.size())];
+                if (&subQueue != homeSubQueue && subQueue.tryLock())
+                {
+                    try
+                    {
+                        subQueue.push(entry, _entryComp);
+                    }
+                    catch (...)
+                    {
+                        subQueue.unlock();
+                        throw;
+                    }
+                    subQueue.unlock();
+                }
+                else
+                {
+                    homeSubQueue->push(entry, _entryComp);
+                }
+                nbPushed++;
+                nbP1Pushed += entry.getP1() ? 1 : 0;
+            }
+        }
+    }
+    catch (...)
+    {
+        // The points that were not pushed are not in the queue.
+        if (nbP1 > nbP1Pushed && 0 == (_nbP1 -= nbP1 - nbP1Pushed) && _stats.isEnabled())
+        {
+            _stats.endP1Phase();
+        }
+        _queueSize -= int(entries.size() - nbPushed);
+        homeSubQueue->unlock();
+        throw;
+    }
+
+    homeSubQueue->unlock();
+}
+
+
+template <typename Priority>
+void BasicQueue<Priority>::lockSubQueue(SubQueue& subQueue) const
+{
+    if (!_stats.isEnabled())
+    {
+        subQueue.lock();
+        return;
+    }
+
+    const double startTime = omp_get_wtime();
+    const bool contended = !subQueue.tryLock();
+    if (contended)
+    {
+        subQueue.lock();
+    }
+    _stats.getLocal().addLockWait(omp_get_wtime() - startTime, contended);
+}
+
+
+template <typename Priority>
+void BasicQueue<Priority>::lockAll() const
+{
+    for (auto& subQueue : _subQueues)
+    {
+        lockSubQueue(*subQueue);
+    }
+}
+
+
+template <typename Priority>
+void BasicQueue<Priority>::unlockAll() const
+{
+    for (auto& subQueue : _subQueues)
+    {
+        subQueue->unlock();
     }
-    if (debugLock) std::cout << "DEBUG: getTopPoint unlocks queue for thread " << omp_get_thread_num() << std::endl;
-    omp_unset_lock(&_queueLock);
-    return retPoint;
+}
+
+
+template <typename Priority>
+void BasicQueue<Priority>::notifyWaitingThreads()
+{
+    // Taking _waitMutex ensures that a thread that just checked for points
+    // in waitForPoints() is already waiting on _waitCond, so the
+    // notification is not lost.
+    std::lock_guard<std::mutex> waitLock(_waitMutex);
+    _waitCond.notify_all();
+}
+
+
+template <typename Priority>
+void BasicQueue<Priority>::waitForPoints()
+{
+    const double startTime = _stats.isEnabled() ? omp_get_wtime() : 0.0;
+    std::unique_lock<std::mutex> waitLock(_waitMutex);
+    _waitCond.wait(waitLock, [this]{ return _queueSize > 0 || _doneWithEval; });
+    if (_stats.isEnabled())
+    {
+        _stats.getLocal().addIdle(omp_get_wtime() - startTime);
+    }
+}
+
+
+template <typename Priority>
+QueuePointHandle BasicQueue<Priority>::getTopPoint() const
+{
+    QueueEntry topEntry;
+    bool found = false;
+    // Best of all SubQueue tops. For MULTIQUEUE backend, SubQueues are
+    // looked at one at a time: this is not a snapshot of the whole queue.
+    for (auto& subQueue : _subQueues)
+    {
+        LOG_TRACE("getTopPoint locks queue for thread " << Threading::getThreadNum());
+        lockSubQueue(*subQueue);
+        if (!subQueue->empty() && (!found || _entryComp(topEntry, subQueue->top())))
+        {
+            topEntry = subQueue->top();
+            found = true;
+        }
+        LOG_TRACE("getTopPoint unlocks queue for thread " << Threading::getThreadNum());
+        subQueue->unlock();
+    }
+    return topEntry.getHandle();
+}
+
+
+template <typename Priority>
+void BasicQueue<Priority>::popFrom(SubQueue& subQueue, QueueEntry &entry)
+{
+    subQueue.pop(entry, _entryComp);
+    if (entry.getP1() && 0 == --_nbP1 && _stats.isEnabled())
+    {
+        _stats.endP1Phase();
+    }
+    if (_stats.isEnabled())
+    {
+        _stats.getLocal().addPop(_queueSize);
+    }
+    _queueSize--;
 }
 
 
 // Get the top Point from the Queue and pop it
 // Return true if it worked, false if it failed.
-bool Queue::popPoint(QueuePointPtr &point)
+template <typename Priority>
+bool BasicQueue<Priority>::popPoint(QueuePointHandle &handle)
+{
+    QueueEntry entry;
+    bool success = popLiveEntry(entry);
+    if (success)
+    {
+        handle = entry.getHandle();
+    }
+
+    return success;
+}
+
+
+template <typename Priority>
+bool BasicQueue<Priority>::isLive(const QueueEntry& entry) const
 {
+    if (isStale(entry))
+    {
+        if (_stats.isEnabled())
+        {
+            _stats.getLocal().addStalePop();
+        }
+        return false;
+    }
+    if (isPruned(entry))
+    {
+        if (_stats.isEnabled())
+        {
+            _stats.getLocal().addPrunedPop();
+        }
+        return false;
+    }
+
+    return true;
+}
+
+
+template <typename Priority>
+bool BasicQueue<Priority>::popLiveEntry(QueueEntry &entry)
+{
+    while (popEntry(entry))
+    {
+        // Points released or cancelled while they were in the queue,
+        // and points that cannot beat the incumbent, are skipped.
+        if (isLive(entry))
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+
+template <typename Priority>
+void BasicQueue<Priority>::cancelPoints(const int threadNum)
+{
+    // O(1): entries are not touched here, they are skipped when popped.
+    _epochs[threadNum % _nbOwners]++;
+}
+
+
+template <typename Priority>
+bool BasicQueue<Priority>::popEntry(QueueEntry &entry)
+{
+    if (QueueBackend::MULTIQUEUE == _backend)
+    {
+        return popEntryRelaxed(entry);
+    }
+    if (QueueBackend::PER_MAIN_THREAD == _backend)
+    {
+        return popEntryLocal(entry);
+    }
+
     bool success = false;
+    SubQueue& subQueue = *_subQueues[0];
     // We need to set the lock before checking if
     // the queue is empty. Or else, we risk a seg fault.
-    if (debugLock) std::cout << "DEBUG: popPoint locks queue for thread " << omp_get_thread_num() << std::endl;
-    omp_set_lock(&_queueLock);  // the thread will wait until the lock is available.
-    if (!_queue.empty())
+    LOG_TRACE("popPoint locks queue for thread " << Threading::getThreadNum());
+    lockSubQueue(subQueue);  // the thread will wait until the lock is available.
+    if (!subQueue.empty())
     {
-        // Remove last element, simulate a "pop".
-        point = std::move(_queue[_queue.size()-1]);
-        _queue.erase(_queue.end()-1);
+        popFrom(subQueue, entry);
         success = true;
     }
-    if (debugLock) std::cout << "DEBUG: popPoint unlocks queue for thread " << omp_get_thread_num() << std::endl;
-    omp_unset_lock(&_queueLock);
+    LOG_TRACE("popPoint unlocks queue for thread " << Threading::getThreadNum());
+    subQueue.unlock();
 
     return success;
 }
 
 
-bool Queue::run()
+template <typename Priority>
+bool BasicQueue<Priority>::popEntryRelaxed(QueueEntry &entry)
 {
+    const size_t nbSubQueues = _subQueues.size();
+    size_t nbAttempts = 0;
+
+    while (_queueSize > 0)
+    {
+        // P1 points must be popped before any other point.
+        if (_nbP1 > 0)
+        {
+            if (popP1(entry, randomIndex(nbSubQueues)))
+            {
+                return true;
+            }
+            continue;
+        }
+
+        bool success = false;
+        nbAttempts++;
+        if (nbAttempts <= nbSubQueues)
+        {
+            // Pop from the best of two random SubQueues. A SubQueue that is
+            // locked by another thread is skipped instead of waited for.
+            SubQueue& subQueue1 = *_subQueues[randomIndex(nbSubQueues)];
+            SubQueue& subQueue2 = *_subQueues[randomIndex(nbSubQueues)];
+            bool locked1 = subQueue1.tryLock();
+            bool locked2 = (&subQueue1 != &subQueue2) && subQueue2.tryLock();
+
+            SubQueue* bestSubQueue = nullptr;
+            if (locked1 && !subQueue1.empty())
+            {
+                bestSubQueue = &subQueue1;
+            }
+            if (locked2 && !subQueue2.empty()
+                && (nullptr == bestSubQueue || _entryComp(bestSubQueue->top(), subQueue2.top())))
+            {
+                bestSubQueue = &subQueue2;
+            }
+            // A P1 point may have been added since we checked.
+            if (nullptr != bestSubQueue && (0 == _nbP1 || bestSubQueue->top().getP1()))
+            {
+                popFrom(*bestSubQueue, entry);
+                success = true;
+            }
+
+            if (locked2)
+            {
+                subQueue2.unlock();
+            }
+            if (locked1)
+            {
+                subQueue1.unlock();
+            }
+        }
+        else
+        {
+            // Random choices keep failing, e.g. because the queue is almost
+            // empty. Look at all SubQueues.
+            for (size_t i = 0; i < nbSubQueues && !success && 0 == _nbP1; i++)
+            {
+                SubQueue& subQueue = *_subQueues[i];
+                lockSubQueue(subQueue);
+                if (!subQueue.empty())
+                {
+                    popFrom(subQueue, entry);
+                    success = true;
+                }
+                subQueue.unlock();
+            }
+            nbAttempts = 0;
+        }
+
+        if (success)
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+
+template <typename Priority>
+bool BasicQueue<Priority>::popEntryLocal(QueueEntry &entry)
+{
+    const size_t nbSubQueues = _subQueues.size();
+    const size_t preferred = _preferredSubQueue[Threading::getThreadNum() % nbSubQueues];
+
+    while (_queueSize > 0)
+    {
+        // P1 points must be popped before any other point.
+        // Look at the preferred SubQueue first.
+        if (_nbP1 > 0)
+        {
+            if (popP1(entry, preferred))
+            {
+                return true;
+            }
+            continue;
+        }
+
+        bool success = false;
+        SubQueue& subQueue = *_subQueues[preferred];
+        lockSubQueue(subQueue);
+        if (!subQueue.empty() && (0 == _nbP1 || subQueue.top().getP1()))
+        {
+            popFrom(subQueue, entry);
+            success = true;
+        }
+        subQueue.unlock();
+        if (success)
+        {
+            return true;
+        }
+
+        // The preferred SubQueue is empty: steal the best point
+        // from the other SubQueues.
+        QueueEntry bestEntry;
+        bool found = false;
+        size_t bestIndex = preferred;
+        for (size_t i = 0; i < nbSubQueues; i++)
+        {
+            if (i == preferred)
+            {
+                continue;
+            }
+            SubQueue& otherSubQueue = *_subQueues[i];
+            lockSubQueue(otherSubQueue);
+            if (!otherSubQueue.empty() && (!found || _entryComp(bestEntry, otherSubQueue.top())))
+            {
+                bestEntry = otherSubQueue.top();
+                bestIndex = i;
+                found = true;
+            }
+            otherSubQueue.unlock();
+        }
+        if (found)
+        {
+            // The top may have changed since we looked at it.
+            // Take the current top anyway: it is still a good point.
+            SubQueue& victim = *_subQueues[bestIndex];
+            lockSubQueue(victim);
+            if (!victim.empty() && (0 == _nbP1 || victim.top().getP1()))
+            {
+                popFrom(victim, entry);
+                success = true;
+            }
+            victim.unlock();
+        }
+        if (success)
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+
+template <typename Priority>
+bool BasicQueue<Priority>::popP1(QueueEntry &entry, const size_t start)
+{
+    // P1 points are always at the top of their SubQueue.
+    // Threads start at different SubQueues so that they do not all
+    // compete for the same lock.
+    const size_t nbSubQueues = _subQueues.size();
+    for (size_t i = 0; i < nbSubQueues && _nbP1 > 0; i++)
+    {
+        SubQueue& subQueue = *_subQueues[(start + i) % nbSubQueues];
+        lockSubQueue(subQueue);
+        bool found = (!subQueue.empty() && subQueue.top().getP1());
+        if (found)
+        {
+            popFrom(subQueue, entry);
+        }
+        subQueue.unlock();
+        if (found)
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+
+template <typename Priority>
+size_t BasicQueue<Priority>::popBatch(const size_t n, std::vector<QueuePointHandle>& handles)
+{
+    static thread_local std::vector<QueueEntry> entries;
+    popEntries(n, entries);
+    handles.clear();
+    for (const auto& entry : entries)
+    {
+        handles.push_back(entry.getHandle());
+    }
+
+    return handles.size();
+}
+
+
+template <typename Priority>
+size_t BasicQueue<Priority>::popEntries(const size_t n, std::vector<QueueEntry>& entries)
+{
+    entries.clear();
+    if (0 == n)
+    {
+        return 0;
+    }
+
+    // A single lock acquisition for the whole batch.
+    SubQueue* subQueue = _subQueues[0].get();
+    if (QueueBackend::MULTIQUEUE == _backend)
+    {
+        subQueue = _subQueues[randomIndex(_subQueues.size())].get();
+    }
+    else if (QueueBackend::PER_MAIN_THREAD == _backend)
+    {
+        subQueue = _subQueues[_preferredSubQueue[Threading::getThreadNum() % _subQueues.size()]].get();
+    }
+
+    LOG_TRACE("popBatch locks queue for thread " << Threading::getThreadNum());
+    lockSubQueue(*subQueue);
+    if (!subQueue->empty())
+    {
+        // A batch never mixes P1 and non-P1 points. Non-P1 points
+        // cannot be popped while there are P1 points in other SubQueues.
+        const bool p1 = subQueue->top().getP1();
+        if (p1 || 0 == _nbP1)
+        {
+            while (entries.size() < n && !subQueue->empty() && subQueue->top().getP1() == p1)
+            {
+                QueueEntry entry;
+                popFrom(*subQueue, entry);
+                // Points released or cancelled while they were in the queue,
+                // and points that cannot beat the incumbent, are skipped.
+                if (isLive(entry))
+                {
+                    entries.push_back(entry);
+                }
+            }
+        }
+    }
+    LOG_TRACE("popBatch unlocks queue for thread " << Threading::getThreadNum());
+    subQueue->unlock();
+
+    // Nothing popped from this SubQueue: pop a single point, looking at
+    // the other SubQueues as the backend does.
+    QueueEntry entry;
+    if (entries.empty() && QueueBackend::LOCKED != _backend && popLiveEntry(entry))
+    {
+        entries.push_back(entry);
+    }
+
+    return entries.size();
+}
+
+
+template <typename Priority>
+bool BasicQueue<Priority>::run()
+{
+    if (_asyncEvaluator)
+    {
+        return runAsync();
+    }
+
     bool successFound = false;
 
     // Queue runs forever on non-main threads.
     // On main threads, queue runs until stopMainEval() is true.
     bool conditionForStop = false;
 
+    // Points are popped by batches. The batch size adapts to the
+    // evaluation time per point, averaged over the last batches.
+    double avgEvalTime = 0.0;
+
+    // With opportunism, a main thread stops when its points are cancelled.
+    const uint32_t startEpoch = getEpoch(Threading::getThreadNum());
+
     // conditionForStop is true if we are in a main thread and stopMainEval() returns true.
     while (!conditionForStop && !_doneWithEval)
     {
-        #pragma omp critical(printInfo)
-        {
-            std::cout << "In Queue::run(). Thread: " << omp_get_thread_num() << std::endl;
-        }
+        LOG_TRACE("In Queue::run(). Thread: " << Threading::getThreadNum());
         // Check for stop conditions
-        if (isMainThread(omp_get_thread_num()))
+        if (isMainThread(Threading::getThreadNum()))
         {
-            conditionForStop = stopMainEval();
+            conditionForStop = stopMainEval()
+                               || (_opportunistic && startEpoch != getEpoch(Threading::getThreadNum()));
         }
 
-        if (!conditionForStop && !_queue.empty())
+        if (!conditionForStop && _queueSize > 0)
         {
-            successFound = evalSinglePoint();
+            size_t nbPoints = 0;
+            double startTime = omp_get_wtime();
+            successFound = evalBatch(computeBatchSize(avgEvalTime), nbPoints);
+            if (nbPoints > 0)
+            {
+                double evalTime = (omp_get_wtime() - startTime) / nbPoints;
+                avgEvalTime = (avgEvalTime <= 0.0) ? evalTime : 0.75 * avgEvalTime + 0.25 * evalTime;
+            }
+            else if (_stats.isEnabled())
+            {
+                // Another thread took the points.
+                _stats.getLocal().addIdle(omp_get_wtime() - startTime);
+            }
         }
         else if (!_doneWithEval)
         {
-            #pragma omp critical(printInfo)
+            // Main threads do not wait: an empty queue is a stop condition for them.
+            if (!conditionForStop)
             {
-                std::cout << "Thread: " << omp_get_thread_num() << " Waiting for points." << std::endl;
+                LOG_DEBUG("Thread: " << Threading::getThreadNum() << " Waiting for points.");
+                // Block until stopAdding() or stop() wakes us up.
+                waitForPoints();
             }
         }
         else // Queue is empty and we are doneWithEval
         {
             break;
         }
-   
-        usleep(100000);
     }   // End of while loop: Exit for main threads.
         // Other threads keep on looping.
-    #pragma omp critical(printInfo)
-    {
-        std::cout << "Thread " << omp_get_thread_num() << " is out of while loop" << std::endl;
-    }
+    LOG_DEBUG("Thread " << Threading::getThreadNum() << " is out of while loop");
 
     return successFound;
 }
 
 
-void Queue::stop()
+template <typename Priority>
+bool BasicQueue<Priority>::runAsync()
 {
-    int threadNum = omp_get_thread_num();
-    _mainThreadInfo.at(threadNum).setDoneWithEval(true);
-    #pragma omp critical(printInfo)
-    {
-        std::cout << "Queue::stop: Stop main thread " << threadNum << "." << std::endl;
-    }
+    bool successFound = false;
+    const int threadNum = Threading::getThreadNum();
+    const uint32_t startEpoch = getEpoch(threadNum);
+
+    // Points submitted by this thread and not evaluated yet.
+    // The tag of a point is its index in inFlight.
+    std::vector<QueueEntry> inFlight;
+    std::vector<uint64_t> freeTags;
+    size_t nbInFlight = 0;
+    // Arena indices of the points in flight: a point popped again while
+    // it is in flight is not submitted again.
+    std::unordered_set<uint32_t> inFlightIndices;
+    // Points with the same coordinates as points being evaluated by other
+    // threads, see claimPoints(). They are claimed again at each loop.
+    std::vector<QueueEntry> pending;
+    // Points with the same coordinates as points submitted with them.
+    std::vector<DuplicateEntry> duplicates;
 
-    // Go through all main thread info to see if _doneWithEval must be set.
-    // This part is not optimized, we can probably do better, but it does not 
-    // seem like a bottleneck.
-    bool allDone = true;
-    for (int mainThreadNum : _mainThreads)
+    std::vector<QueueEntry> entries;
+    std::vector<QueueEntry> toSubmit;
+    std::vector<QueueEntry> stillPending;
+    std::vector<DuplicateEntry> newDuplicates;
+    PointBatch batch;
+    std::vector<uint64_t> tags;
+    std::vector<AsyncResult> results;
+
+    while (true)
     {
-        if (allDone && !_mainThreadInfo.at(mainThreadNum).getDoneWithEval())
+        // Same stop conditions as run(). Points in flight, and points
+        // waiting for other threads, are always completed before returning.
+        bool conditionForStop = _doneWithEval;
+        if (isMainThread(threadNum))
+        {
+            conditionForStop = conditionForStop || stopMainEval()
+                               || (_opportunistic && startEpoch != getEpoch(threadNum));
+        }
+
+        // Keep up to _maxInFlight evaluations running.
+        size_t nbSubmitted = 0;
+        if (nbInFlight < _maxInFlight && (!pending.empty() || (!conditionForStop && _queueSize > 0)))
+        {
+            toSubmit.clear();
+            if (!conditionForStop && _queueSize > 0)
+            {
+                popEntries(_maxInFlight - nbInFlight, entries);
+                for (const auto& entry : entries)
+                {
+                    if (!isStale(entry) && !isPruned(entry) && !evalFromCache(entry.getHandle())
+                        && 0 == inFlightIndices.count(entry.getHandle().getIndex()))
+                    {
+                        toSubmit.push_back(entry);
+                    }
+                }
+                removeDuplicates(toSubmit, newDuplicates);
+                duplicates.insert(duplicates.end(), newDuplicates.begin(), newDuplicates.end());
+            }
+            toSubmit.insert(toSubmit.end(), pending.begin(), pending.end());
+            claimPoints(toSubmit, stillPending);
+            pending.swap(stillPending);
+
+            batch.clear();
+            tags.clear();
+            for (const auto& entry : toSubmit)
+            {
+                uint64_t tag = inFlight.size();
+                if (freeTags.empty())
+                {
+                    inFlight.push_back(entry);
+                }
+                else
+                {
+                    tag = freeTags.back();
+                    freeTags.pop_back();
+                    inFlight[tag] = entry;
+                }
+                inFlightIndices.insert(entry.getHandle().getIndex());
+                tags.push_back(tag);
+                batch.add(_arena.get(entry.getHandle()));
+            }
+            if (!tags.empty())
+            {
+                try
+                {
+                    _asyncEvaluator->submit(batch, tags.data());
+                }
+                catch (...)
+                {
+                    releasePoints(toSubmit);
+                    throw;
+                }
+                nbInFlight += tags.size();
+                nbSubmitted = tags.size();
+            }
+        }
+
+        if (nbInFlight > 0)
         {
-            allDone = false;
-            #pragma omp critical(printInfo)
+            // Do not wait for evaluations if more points can be submitted.
+            const bool canSubmit = !conditionForStop && nbInFlight < _maxInFlight && _queueSize > 0;
+            const double startTime = _stats.isEnabled() ? omp_get_wtime() : 0.0;
+            results.clear();
+            _asyncEvaluator->poll(results, canSubmit ? 0.0 : ASYNC_POLL_TIMEOUT);
+            if (_stats.isEnabled())
             {
-                std::cout << "Queue::stop: Not done with queue because thread " << mainThreadNum << " is not done." << std::endl;
+                _stats.getLocal().addEvals(results.size(), omp_get_wtime() - startTime);
             }
+            for (const auto& result : results)
+            {
+                // The point may have been evaluated by another thread:
+                // setEvalResult() drops the eval.
+                const QueueEntry& entry = inFlight[result._tag];
+                successFound = setEvalResult(entry, result._eval) || successFound;
+                inFlightIndices.erase(entry.getHandle().getIndex());
+                freeTags.push_back(result._tag);
+                nbInFlight--;
+            }
+        }
+        else if (!pending.empty())
+        {
+            if (0 == nbSubmitted)
+            {
+                std::this_thread::sleep_for(std::chrono::duration<double>(PENDING_POLL_INTERVAL));
+            }
+        }
+        else if (conditionForStop)
+        {
             break;
         }
+        else if (0 == _queueSize)
+        {
+            // Block until stopAdding() or stop() wakes us up.
+            waitForPoints();
+        }
+
+        // Duplicates get the evaluation of their original point once it
+        // is no longer in flight, nor waiting for another thread.
+        for (size_t i = 0; i < duplicates.size(); )
+        {
+            const QueuePointHandle original = duplicates[i]._original;
+            const bool isWaiting = (0 != inFlightIndices.count(original.getIndex()))
+                                   || std::any_of(pending.begin(), pending.end(),
+                                                  [&original](const QueueEntry& entry) { return entry.getHandle() == original; });
+            if (isWaiting && !_arena.get(original).isEvaluated())
+            {
+                i++;
+                continue;
+            }
+            setDuplicateEval(duplicates[i]);
+            duplicates[i] = duplicates.back();
+            duplicates.pop_back();
+        }
     }
+    LOG_DEBUG("Thread " << threadNum << " is out of async loop");
+
+    return successFound;
+}
 
-    if (allDone)
+
+template <typename Priority>
+void BasicQueue<Priority>::stop()
+{
+    int threadNum = Threading::getThreadNum();
     {
-        #pragma omp critical(printInfo)
+        std::lock_guard<std::mutex> rolesLock(_rolesMutex);
+        if (!_isMain[threadNum % _nbOwners].exchange(false))
         {
-            std::cout << "Queue::stop: All main threads done. Done with queue." << std::endl;
+            LOG_WARNING("Queue::stop: Thread " << threadNum << " is not a main thread.");
+            return;
         }
+        updatePreferredSubQueues();
+    }
+    LOG_INFO("Queue::stop: Stop main thread " << threadNum << ".");
+
+    // The last main thread to stop ends the evaluation for all threads.
+    const int nbMainThreads = --_nbMainThreads;
+    if (nbMainThreads > 0)
+    {
+        LOG_DEBUG("Queue::stop: Not done with queue, " << nbMainThreads << " main threads are not done.");
+    }
+    else
+    {
+        LOG_INFO("Queue::stop: All main threads done. Done with queue.");
         _doneWithEval = true;
+        // Release threads waiting for points.
+        notifyWaitingThreads();
+    }
+
+}
+
+
+template <typename Priority>
+void BasicQueue<Priority>::sort(Priority comp)
+{
+    // Before the locks are taken: the heaps are reordered with comp.
+    comp.checkDimension(getDimension());
+
+    LOG_TRACE("sort locks queue for thread " << Threading::getThreadNum());
+    lockAll();
+    const double startTime = _stats.isEnabled() ? omp_get_wtime() : 0.0;
+
+    // The heaps must always be ordered with the comparison function
+    // used for insertions.
+    _comp = comp;
+    _compVersion++;
+    for (auto& subQueue : _subQueues)
+    {
+        subQueue->rekey(_entryComp);
+    }
+    if (_stats.isEnabled())
+    {
+        _stats.getLocal().addSortHold(omp_get_wtime() - startTime);
     }
 
+    LOG_TRACE("sort unlocks queue for thread " << Threading::getThreadNum());
+    unlockAll();
 }
 
 
-void Queue::sort(LowerPriority comp)
+template <typename Priority>
+void BasicQueue<Priority>::rekey(Priority comp)
 {
-    if (!_queue.empty())
+    if (!comp.hasCost())
+    {
+        sort(comp);
+        return;
+    }
+
+    std::lock_guard<std::mutex> rekeyLock(_rekeyMutex);
+
+    // Copy the heaps of each SubQueue, one SubQueue at a time.
+    const size_t nbSubQueues = _subQueues.size();
+    std::vector<std::vector<QueueEntry>> p1Heaps(nbSubQueues), heaps(nbSubQueues);
+    for (size_t i = 0; i < nbSubQueues; i++)
     {
-        if (debugLock) std::cout << "DEBUG: sort locks queue for thread " << omp_get_thread_num() << std::endl;
-        omp_set_lock(&_queueLock);
+        lockSubQueue(*_subQueues[i]);
+        _subQueues[i]->startRekey(p1Heaps[i], heaps[i]);
+        _subQueues[i]->unlock();
+    }
 
-        std::sort(_queue.begin(), _queue.end(), comp);
+    // Compute the new keys and order the copies, without any lock.
+    // Blocks of entries are shared between threads, if rekey() is not
+    // called from a parallel region.
+    const EntryPriority<Priority> newEntryComp(_arena, comp);
+    const size_t blockSize = 4096;
+    std::vector<std::pair<QueueEntry*, size_t>> blocks;
+    for (size_t i = 0; i < nbSubQueues; i++)
+    {
+        for (auto* heap : { &p1Heaps[i], &heaps[i] })
+        {
+            for (size_t start = 0; start < heap->size(); start += blockSize)
+            {
+                blocks.emplace_back(heap->data() + start, std::min(blockSize, heap->size() - start));
+            }
+        }
+    }
+    #pragma omp parallel for schedule(dynamic) if(!Threading::inParallel())
+    for (size_t b = 0; b < blocks.size(); b++)
+    {
+        newEntryComp.computeKeys(blocks[b].first, blocks[b].second);
+    }
+    #pragma omp parallel for schedule(dynamic) if(!Threading::inParallel())
+    for (size_t i = 0; i < 2 * nbSubQueues; i++)
+    {
+        auto& heap = (i < nbSubQueues) ? p1Heaps[i] : heaps[i - nbSubQueues];
+        std::make_heap(heap.begin(), heap.end(), newEntryComp);
+    }
 
-        if (debugLock) std::cout << "DEBUG: sort unlocks queue for thread " << omp_get_thread_num() << std::endl;
-        omp_unset_lock(&_queueLock);
+    // Swap the new heaps in. All locks are held, so that no point is added
+    // with the previous comparison function once a SubQueue uses the new one.
+    lockAll();
+    const double startTime = _stats.isEnabled() ? omp_get_wtime() : 0.0;
+    _comp = comp;
+    _compVersion++;
+    for (size_t i = 0; i < nbSubQueues; i++)
+    {
+        _subQueues[i]->finishRekey(p1Heaps[i], heaps[i], _entryComp);
+    }
+    if (_stats.isEnabled())
+    {
+        _stats.getLocal().addSortHold(omp_get_wtime() - startTime);
     }
+    unlockAll();
 }
 
 
-bool Queue::evalSinglePoint()
+template <typename Priority>
+bool BasicQueue<Priority>::evalSinglePoint()
+{
+    // Thread-local, so that the vector is not reallocated at each call.
+    static thread_local std::vector<QueueEntry> entries(1);
+    bool pointAvailable = popLiveEntry(entries[0]);
+
+    // else do nothing. No point available: either queue is empty,
+    // queue is locked, or point is already evaluated.
+    return (pointAvailable && evalPoints(entries));
+}
+
+
+template <typename Priority>
+bool BasicQueue<Priority>::evalBatch(const size_t maxNbPoints, size_t& nbPoints)
+{
+    // Thread-local, so that the vector is not reallocated at each batch.
+    static thread_local std::vector<QueueEntry> entries;
+    nbPoints = popEntries(maxNbPoints, entries);
+
+    return evalPoints(entries);
+}
+
+
+template <typename Priority>
+bool BasicQueue<Priority>::evalPoints(const std::vector<QueueEntry>& entries)
 {
     bool success = false;
 
-    QueuePointPtr point;
-    bool pointAvailable = popPoint(point);
+    // Gather the points that are not evaluated yet, and evaluate them
+    // in a single call to the evaluator.
+    static thread_local std::vector<QueueEntry> toEval;
+    static thread_local std::vector<QueueEntry> pending;
+    static thread_local std::vector<DuplicateEntry> duplicates;
+    static thread_local PointBatch batch;
+    static thread_local std::vector<double> evals;
+    toEval.clear();
+    for (const auto& entry : entries)
+    {
+        // Points may have been cancelled, or the incumbent improved,
+        // since they were popped. Duplicates may have been evaluated since
+        // they were added.
+        if (!isStale(entry) && !isPruned(entry) && !evalFromCache(entry.getHandle()))
+        {
+            toEval.push_back(entry);
+        }
+        // else do nothing: point is already evaluated, or cancelled.
+    }
+    // A point added twice, or two points with the same coordinates, may
+    // be popped in the same batch: evaluate them once.
+    removeDuplicates(toEval, duplicates);
 
-    // Simulate evaluation
-    if (pointAvailable && 0 == point->getEval())
+    while (!toEval.empty())
     {
-        // Eval is between 1 and 50
-        double eval = 1+std::rand()/((RAND_MAX + 1u)/50);
-        #pragma omp critical(printInfo)
+        // Points with the same coordinates as points being evaluated by
+        // other threads are not evaluated: their evaluations are taken
+        // from the cache when they are done.
+        claimPoints(toEval, pending);
+        if (toEval.empty())
         {
-            std::cout << "In thread: " << omp_get_thread_num() << " Eval point " << *point << " to " << eval << std::endl;
+            std::this_thread::sleep_for(std::chrono::duration<double>(PENDING_POLL_INTERVAL));
         }
-        point->setEval(eval);
-        if (eval < point->getBestEval())
+        else
         {
-            success = true;
-            #pragma omp critical(printInfo)
+            batch.clear();
+            for (const auto& entry : toEval)
             {
-                std::cout << "Thread " << omp_get_thread_num() << ". New success found: " << *point << std::endl;
+                batch.add(_arena.get(entry.getHandle()));
+            }
+
+            evals.resize(toEval.size());
+            const double startTime = _stats.isEnabled() ? omp_get_wtime() : 0.0;
+            try
+            {
+                _evaluator->eval(batch, evals.data());
+            }
+            catch (...)
+            {
+                releasePoints(toEval);
+                throw;
+            }
+            if (_stats.isEnabled())
+            {
+                _stats.getLocal().addEvals(toEval.size(), omp_get_wtime() - startTime);
+            }
+
+            for (size_t i = 0; i < toEval.size(); i++)
+            {
+                success = setEvalResult(toEval[i], evals[i]) || success;
             }
-            // In NOMAD, we would update new point's best eval to this value.
-            // Not done here - best eval is static.
         }
+        toEval.swap(pending);
     }
-    else
+
+    for (const auto& duplicate : duplicates)
     {
-        // else do nothing. No point available: either queue is empty, 
-        // queue is locked, or point is already evaluated.
+        setDuplicateEval(duplicate);
     }
 
     return success;
 }
 
 
-bool Queue::stopMainEval() const
+template <typename Priority>
+void BasicQueue<Priority>::claimPoints(std::vector<QueueEntry>& entries, std::vector<QueueEntry>& pending)
 {
-    bool stop = false;
-    // This method was called from a main thread. No need to verify
-    // thread number.
-    if (_queue.empty())
+    pending.clear();
+    size_t nbClaimed = 0;
+    for (const auto& entry : entries)
     {
-        stop = true;
+        if (isStale(entry) || isPruned(entry))
+        {
+            continue;
+        }
+        QueuePoint& point = _arena.get(entry.getHandle());
+        if (point.isEvaluated())
+        {
+            continue;
+        }
+        if (!_cache)
+        {
+            entries[nbClaimed++] = entry;
+            continue;
+        }
+
+        double eval = 0;
+        switch (_cache->claim(point, eval))
+        {
+            case CacheLookup::HIT:
+                LOG_DEBUG("In thread: " << Threading::getThreadNum() << " Cache hit for point " << point << ": " << eval);
+                point.setEvalIfNone(eval);
+                if (_stats.isEnabled())
+                {
+                    _stats.getLocal().addCacheHit();
+                }
+                break;
+            case CacheLookup::CLAIMED:
+                entries[nbClaimed++] = entry;
+                break;
+            case CacheLookup::PENDING:
+                pending.push_back(entry);
+                break;
+        }
     }
-    else
+    entries.resize(nbClaimed);
+}
+
+
+template <typename Priority>
+void BasicQueue<Priority>::releasePoints(const std::vector<QueueEntry>& entries)
+{
+    if (_cache)
+    {
+        for (const auto& entry : entries)
+        {
+            _cache->release(_arena.get(entry.getHandle()));
+        }
+    }
+}
+
+
+template <typename Priority>
+void BasicQueue<Priority>::removeDuplicates(std::vector<QueueEntry>& entries, std::vector<DuplicateEntry>& duplicates) const
+{
+    duplicates.clear();
+    if (entries.size() < 2)
     {
-        // Are we still evaluating P1s?
-        // If we have a P1, we have not evaluated all P1.
-        // If we don't have a P1, we can stop evaluation for
-        // the main thread.
-        bool stillInP1 = getTopPoint()->getP1();
-        stop = !stillInP1;
+        return;
     }
 
-    return stop;
+    // Sort by coordinates, then by handle, so that duplicates are adjacent.
+    const size_t dimension = getDimension();
+    auto lessCoords = [this, dimension](const QueueEntry& e1, const QueueEntry& e2)
+    {
+        const double* coords1 = _arena.get(e1.getHandle()).getCoords();
+        const double* coords2 = _arena.get(e2.getHandle()).getCoords();
+        return std::lexicographical_compare(coords1, coords1 + dimension, coords2, coords2 + dimension);
+    };
+    std::sort(entries.begin(), entries.end(), [&lessCoords](const QueueEntry& e1, const QueueEntry& e2)
+    {
+        return lessCoords(e1, e2)
+               || (!lessCoords(e2, e1) && e1.getHandle().getIndex() < e2.getHandle().getIndex());
+    });
+
+    size_t nbDistinct = 0;
+    QueuePointHandle previousHandle;
+    for (size_t i = 0; i < entries.size(); i++)
+    {
+        const QueueEntry entry = entries[i];
+        if (nbDistinct > 0 && !lessCoords(entries[nbDistinct - 1], entry))
+        {
+            // Same coordinates as the last distinct entry. The same point
+            // popped twice is dropped.
+            if (!(entry.getHandle() == previousHandle))
+            {
+                DuplicateEntry duplicate;
+                duplicate._entry = entry;
+                duplicate._original = entries[nbDistinct - 1].getHandle();
+                duplicates.push_back(duplicate);
+            }
+        }
+        else
+        {
+            entries[nbDistinct++] = entry;
+        }
+        previousHandle = entry.getHandle();
+    }
+    entries.resize(nbDistinct);
 }
 
 
-void Queue::setAllP1ToFalse()
+template <typename Priority>
+void BasicQueue<Priority>::setDuplicateEval(const DuplicateEntry& duplicate)
 {
-    //omp_set_lock(&_queueLock);
-    if (!_queue.empty())
+    // Same as a cache hit: the point is not evaluated. The original point
+    // may not be evaluated, e.g. if it was cancelled, or its evaluation
+    // may have failed.
+    const QueuePoint& original = _arena.get(duplicate._original);
+    QueuePoint& point = _arena.get(duplicate._entry.getHandle());
+    if (original.isEvaluated() && !std::isnan(original.getEval()) && point.setEvalIfNone(original.getEval()))
     {
-        // For all P1 points - they are always at the front -
-        // Pop, Set P1 to false, and push back.
-        // Pop all P1 points (they are all at the front).
-        // Set P1 to false.
-        QueuePointPtr point;
-        while (getTopPoint()->getP1() && popPoint(point))
+        LOG_DEBUG("In thread: " << Threading::getThreadNum() << " Same coordinates as an evaluated point for point " << point);
+        if (_stats.isEnabled())
         {
-            #pragma omp critical(printInfo)
+            _stats.getLocal().addCacheHit();
+        }
+    }
+}
+
+
+template <typename Priority>
+bool BasicQueue<Priority>::setEvalResult(const QueueEntry& entry, const double eval)
+{
+    bool success = false;
+    QueuePoint& point = _arena.get(entry.getHandle());
+    // Another thread may have evaluated the same point meanwhile: its
+    // evaluation is kept, and this one is dropped.
+    if (!point.setEvalIfNone(eval))
+    {
+        LOG_DEBUG("In thread: " << Threading::getThreadNum() << " Point " << point << " already evaluated, drop eval " << eval);
+        if (_cache)
+        {
+            // Ends the claim of the point. Failed evaluations are not cached.
+            const double cachedEval = std::isnan(point.getEval()) ? eval : point.getEval();
+            if (std::isnan(cachedEval))
             {
-                std::cout << "Pop P1" << std::endl;
+                _cache->release(point);
+            }
+            else
+            {
+                _cache->insert(point, cachedEval);
             }
-            point->setP1(false);
-            _queue.push_back(point);
         }
-        // re-sort queue
-        sort();
+        return false;
     }
-    //omp_unset_lock(&_queueLock);
+    if (std::isnan(eval))
+    {
+        // The evaluation failed: it is neither cached nor journaled, so
+        // that points with the same coordinates are evaluated again.
+        LOG_WARNING("In thread: " << Threading::getThreadNum() << " Evaluation failed for point " << point);
+        if (_cache)
+        {
+            _cache->release(point);
+        }
+        return false;
+    }
+    LOG_INFO("In thread: " << Threading::getThreadNum() << " Eval point " << point << ", best eval was " << point.getBestEval());
+    if (_cache)
+    {
+        _cache->insert(point, eval);
+    }
+    if (_journal)
+    {
+        _journal->append(point, eval);
+    }
+    // The best eval of the point may be older than the incumbent, which
+    // is shared by all threads.
+    if (eval < point.getBestEval() && updateIncumbent(eval))
+    {
+        success = true;
+        LOG_INFO("Thread " << Threading::getThreadNum() << ". New success found: " << point);
+
+        // Opportunism: the other points of the main thread that added
+        // this point do not need to be evaluated.
+        if (_opportunistic && entry.getEpoch() == _epochs[entry.getOwner()])
+        {
+            _epochs[entry.getOwner()]++;
+            LOG_INFO("Thread " << Threading::getThreadNum() << ". Cancel points of thread " << entry.getOwner());
+        }
+    }
+
+    return success;
+}
+
+
+template <typename Priority>
+bool BasicQueue<Priority>::updateIncumbent(const double eval)
+{
+    double incumbent = _incumbent.load(std::memory_order_relaxed);
+    while (eval < incumbent)
+    {
+        // On failure, incumbent is reloaded: another thread updated it.
+        if (_incumbent.compare_exchange_weak(incumbent, eval, std::memory_order_relaxed))
+        {
+            return true;
+        }
+    }
+
+    return false;
 }
 
 
-void Queue::clearQueue()
+template <typename Priority>
+size_t BasicQueue<Priority>::setJournal(const std::shared_ptr<EvalJournal>& journal)
 {
-    if (debugLock) std::cout << "DEBUG: clearQueue locks queue for thread " << omp_get_thread_num() << std::endl;
-    omp_set_lock(&_queueLock);
-    _queue.clear();
-    if (debugLock) std::cout << "DEBUG: clearQueue unlocks queue for thread " << omp_get_thread_num() << std::endl;
-    omp_unset_lock(&_queueLock);
+    if (journal && journal->getDimension() != getDimension())
+    {
+        throw std::invalid_argument("Queue: journal of dimension " + std::to_string(journal->getDimension())
+                                    + " for points of dimension " + std::to_string(getDimension()));
+    }
+
+    size_t nbLoaded = 0;
+    if (journal)
+    {
+        const size_t dimension = getDimension();
+        nbLoaded = journal->forEach([this, dimension](const double* coords, const double eval, const double)
+        {
+            if (_cache)
+            {
+                _cache->insert(QueuePoint(coords, dimension, 0), eval);
+            }
+            updateIncumbent(eval);
+        });
+    }
+    _journal = journal;
+
+    return nbLoaded;
 }
 
 
-void Queue::displayAndClear()
+template <typename Priority>
+bool BasicQueue<Priority>::evalFromCache(const QueuePointHandle& handle)
 {
-    //omp_set_lock(&_queueLock);
-    QueuePointPtr point;
-    while (!_queue.empty() && popPoint(point))
+    QueuePoint& point = _arena.get(handle);
+    if (point.isEvaluated())
+    {
+        // Already evaluated.
+        return true;
+    }
+
+    double eval = 0;
+    if (_cache && _cache->find(point, eval))
     {
-        #pragma omp critical(printInfo)
+        LOG_DEBUG("In thread: " << Threading::getThreadNum() << " Cache hit for point " << point << ": " << eval);
+        point.setEvalIfNone(eval);
+        if (_stats.isEnabled())
         {
-            std::cout << *point << std::endl;
+            _stats.getLocal().addCacheHit();
         }
+        return true;
     }
-    //omp_unset_lock(&_queueLock);
+
+    return false;
 }
 
 
+template <typename Priority>
+size_t BasicQueue<Priority>::computeBatchSize(const double avgEvalTime) const
+{
+    // No measure yet: start with a single point.
+    if (avgEvalTime <= 0.0)
+    {
+        return 1;
+    }
 
-std::ostream& operator<<(std::ostream& out, const QueuePoint& point)
+    // Enough points to keep the thread busy for _targetBatchTime.
+    double nbPointsForTime = _targetBatchTime / avgEvalTime;
+    size_t batchSize = (nbPointsForTime >= double(_maxBatchSize)) ? _maxBatchSize : size_t(nbPointsForTime);
+
+    // Do not take more than a fair share of the queue, so that other
+    // threads are not left without points.
+    size_t fairShare = size_t(_queueSize) / size_t(Threading::getNbThreads());
+    batchSize = std::min(batchSize, fairShare);
+
+    return std::max(batchSize, size_t(1));
+}
+
+
+template <typename Priority>
+bool BasicQueue<Priority>::stopMainEval() const
 {
-    //out << "X " << point.getX() << " Y " << point.getY() << " P1 " << point.getP1() << " best eval " << point.getBestEval();
-    out << "X " << point.getX() << " Y " << point.getY() << " eval " << point.getEval();
-    return out;
+    // This method was called from a main thread. No need to verify
+    // thread number.
+    // Are we still evaluating P1s?
+    // If we have a P1, we have not evaluated all P1.
+    // If we don't have a P1, we can stop evaluation for
+    // the main thread. This is also the case if the queue is empty.
+    // The P1 points are counted, so no lock is needed.
+    bool stillInP1 = (_nbP1 > 0);
+
+    return !stillInP1;
+}
+
+
+template <typename Priority>
+void BasicQueue<Priority>::setAllP1ToFalse()
+{
+    size_t nbP1 = 0;
+    for (auto& subQueue : _subQueues)
+    {
+        LOG_TRACE("setAllP1ToFalse locks queue for thread " << Threading::getThreadNum());
+        lockSubQueue(*subQueue);
+        size_t nbP1SubQueue = subQueue->setAllP1ToFalse(_arena, _entryComp);
+        if (nbP1SubQueue > 0 && 0 == (_nbP1 -= int(nbP1SubQueue)) && _stats.isEnabled())
+        {
+            _stats.endP1Phase();
+        }
+        nbP1 += nbP1SubQueue;
+        LOG_TRACE("setAllP1ToFalse unlocks queue for thread " << Threading::getThreadNum());
+        subQueue->unlock();
+    }
+    LOG_INFO("Set P1 to false for " << nbP1 << " points");
 }
 
 
+template <typename Priority>
+void BasicQueue<Priority>::clearQueue()
+{
+    LOG_TRACE("clearQueue locks queue for thread " << Threading::getThreadNum());
+    lockAll();
+    // Points being added by other threads are already counted: only the
+    // points that are in the SubQueues are removed from the counts.
+    int nbPoints = 0;
+    int nbP1 = 0;
+    for (auto& subQueue : _subQueues)
+    {
+        nbPoints += int(subQueue->size());
+        nbP1 += int(subQueue->getNbP1());
+        subQueue->clear();
+    }
+    _queueSize -= nbPoints;
+    if (nbP1 > 0 && 0 == (_nbP1 -= nbP1) && _stats.isEnabled())
+    {
+        _stats.endP1Phase();
+    }
+    LOG_TRACE("clearQueue unlocks queue for thread " << Threading::getThreadNum());
+    unlockAll();
+}
+
 
+template <typename Priority>
+void BasicQueue<Priority>::displayAndClear()
+{
+    //omp_set_lock(&_queueLock);
+    QueuePointHandle handle;
+    while (_queueSize > 0 && popPoint(handle))
+    {
+        LOG_INFO(_arena.get(handle));
+    }
+    //omp_unset_lock(&_queueLock);
+}
+
+
+
+std::ostream& operator<<(std::ostream& out, const QueuePoint& point)
+{
+    //out << "Coords ( ... ) P1 " << point.getP1() << " best eval " << point.getBestEval();
+    out << "Coords (";
+    for (size_t i = 0; i < point.getDimension(); i++)
+    {
+        out << " " << point.getCoord(i);
+    }
+    out << " ) eval " << point.getEval();
+    return out;
+}
 
 
+// Explicit instantiations: the type-erased LowerPriority, and the
+// ready-made compile-time policies.
+template class BasicQueue<LowerPriority>;
+template class BasicQueue<StaticLowerPriority<DefaultPriority>>;
+template class BasicQueue<StaticLowerPriority<DirectionPriority>>;
+template class BasicQueue<StaticLowerPriority<CompOnly<DefaultPriority>>>;
+template class BasicQueue<StaticLowerPriority<CompOnly<DirectionPriority>>>;
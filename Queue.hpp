@@ -2,78 +2,286 @@
 #ifndef __QUEUE_HPP__
 #define __QUEUE_HPP__
 
-#include <map>
-#include <set>
+#include <atomic>
+#include <condition_variable>
+#include <limits>       // For infinity
+#include <memory>
+#include <mutex>
 #include <vector>
 
+#include "EvalCache.hpp"
+#include "EvalJournal.hpp"
+#include "Logger.hpp"
+#include "Evaluator.hpp"
+#include "PointArena.hpp"
+#include "PriorityPolicy.hpp"
 #include "QueuePoint.hpp"
+#include "QueueStats.hpp"
+#include "SubQueue.hpp"
+#include "Threading.hpp"
 
-class MainThreadInfo
+// How points are stored in the Queue.
+enum class QueueBackend
 {
-private:
-    bool _doneWithEval;             // All evaluations done for this main thread
-
-public:
-    explicit MainThreadInfo()
-      : _doneWithEval(false)
-    {
-    }
+    LOCKED,         // A single heap protected by a single lock.
+    MULTIQUEUE,     // Relaxed concurrent priority queue: several heaps, each
+                    // with its own lock. Points are added to a random heap,
+                    // and popped from the best of two random heaps. P1 points
+                    // are still always popped before non-P1 points.
+    PER_MAIN_THREAD // One heap per main thread. Each main thread adds points
+                    // to its own heap. Each thread pops from a preferred heap,
+                    // and steals the best point of the other heaps when its
+                    // preferred heap is empty. P1 points are still always
+                    // popped before non-P1 points.
+};
 
-    void setDoneWithEval(const bool doneWithEval)
-    {
-        _doneWithEval = doneWithEval;
-    }
 
-    bool getDoneWithEval() const { return _doneWithEval; }
+// Maximum time, in seconds, that run() waits for asynchronous evaluations
+// before checking its stop conditions again.
+const double ASYNC_POLL_TIMEOUT = 0.001;
 
-};
+// Time, in seconds, between two checks for the evaluation of a point being
+// evaluated by another thread.
+const double PENDING_POLL_INTERVAL = 0.0001;
 
 
-class Queue
+// Queue of points to evaluate.
+// Priority is the type of the comparison function: the type-erased
+// LowerPriority, or a StaticLowerPriority with a compile-time policy.
+// Member functions are defined in Queue.cpp and instantiated there for
+// LowerPriority and for the ready-made policies of PriorityPolicy.hpp.
+// Threads are identified by Threading::getThreadNum(), and per-thread data
+// is sized with Threading::getMaxThreads(): the queue may be used by an
+// OpenMP parallel region, by a WorkerPool, or by the threads of a host
+// application that set their numbers.
+template <typename Priority>
+class BasicQueue
 {
 private:
-    std::vector<QueuePointPtr> _queue;  // The queue of points
-    LowerPriority _comp;            // Comparison function used for sorting
-    bool _doneWithEval;             // All evaluations done for all main threads. Queue can be destroyed.
-    mutable omp_lock_t _queueLock;  // Do not launch new evaluations when queue is locked, e.g. for adding points.
-    std::set<int> _mainThreads;     // Thread numbers of main threads
-    std::map<int, MainThreadInfo> _mainThreadInfo;
+    PointArena _arena;              // Storage for the points. The queue only holds handles to them.
+    QueueBackend _backend;
+    std::vector<std::unique_ptr<SubQueue>> _subQueues;  // The queue of points. A single SubQueue for LOCKED backend.
+    std::unique_ptr<std::atomic<int>[]> _preferredSubQueue;    // For PER_MAIN_THREAD backend: index of the SubQueue each thread pops from first, indexed by thread number modulo number of SubQueues
+    std::atomic<int> _queueSize;    // Total number of points, readable without taking any lock
+    std::atomic<int> _nbP1;         // Number of P1 points in the queue
+    Priority _comp;                 // Comparison function used for ordering the heaps
+    EntryPriority<Priority> _entryComp;     // Comparison of queue entries, using _arena and _comp
+    std::shared_ptr<Evaluator> _evaluator;  // Evaluates the points popped by run()
+    std::shared_ptr<AsyncEvaluator> _asyncEvaluator;   // If not null, run() evaluates points asynchronously with it
+    size_t _maxInFlight;            // Maximum number of points in flight per thread, for asynchronous evaluation
+    std::shared_ptr<EvalCache> _cache;      // Evaluations already done, by coordinates. May be null.
+    std::shared_ptr<EvalJournal> _journal;  // Every evaluation is appended to it. May be null.
+    size_t _nbOwners;               // Size of _epochs
+    std::unique_ptr<std::atomic<uint32_t>[]> _epochs;   // Epoch of the points added by each thread, indexed by thread number modulo _nbOwners
+    bool _opportunistic;            // Cancel the points of a main thread when one of them is a success
+    std::atomic<double> _incumbent; // Best evaluation found by all threads
+    std::atomic<bool> _doneWithEval;    // All evaluations done for all main threads. Queue can be destroyed.
+    size_t _maxBatchSize;           // Maximum number of points popped at once by run()
+    double _targetBatchTime;        // Time, in seconds, that a batch popped by run() should take to evaluate
+    std::mutex _waitMutex;          // Protects the wait on _waitCond
+    std::condition_variable _waitCond;  // Idle threads wait on it until points are added or evaluation is done
+    std::mutex _rekeyMutex;         // A single rekey() at a time
+    std::atomic<uint64_t> _compVersion;     // Incremented when _comp changes, with all SubQueues locked
+    std::mutex _rolesMutex;         // Protects role changes
+    std::unique_ptr<std::atomic<bool>[]> _isMain;   // Is each thread a main thread, indexed by thread number modulo _nbOwners
+    std::atomic<int> _nbMainThreads;    // Main threads that did not stop. Evaluation is done when it drops to 0.
+    mutable QueueStats _stats;      // Instrumentation. Disabled by default.
 
 
 public:
     // Constructor
-    explicit Queue(LowerPriority comp)
-      : _queue(),
+    // For MULTIQUEUE backend, nbSubQueues is the number of heaps. If it is 0,
+    // use twice the maximum number of threads.
+    // For PER_MAIN_THREAD backend, main thread number t owns heap
+    // t modulo nbSubQueues. If nbSubQueues is 0, use the maximum number
+    // of threads, so that each main thread has its own heap.
+    // All points of the queue have the given dimension.
+    explicit BasicQueue(Priority comp,
+                   QueueBackend backend = QueueBackend::LOCKED,
+                   int nbSubQueues = 0,
+                   size_t dimension = 2)
+      : _arena(dimension),
+        _backend(backend),
+        _subQueues(),
+        _preferredSubQueue(),
+        _queueSize(0),
+        _nbP1(0),
         _comp(comp),
+        _entryComp(_arena, _comp),
+        _evaluator(std::make_shared<MockEvaluator>()),
+        _asyncEvaluator(),
+        _maxInFlight(1),
+        _cache(std::make_shared<EvalCache>()),
+        _journal(),
+        _nbOwners(Threading::getMaxThreads()),
+        _epochs(new std::atomic<uint32_t>[_nbOwners]),
+        _opportunistic(false),
+        _incumbent(std::numeric_limits<double>::infinity()),
         _doneWithEval(false),
-        _queueLock(),
-        _mainThreads(),
-        _mainThreadInfo()
+        _maxBatchSize(64),
+        _targetBatchTime(0.001),
+        _waitMutex(),
+        _waitCond(),
+        _rekeyMutex(),
+        _compVersion(0),
+        _rolesMutex(),
+        _isMain(new std::atomic<bool>[_nbOwners]),
+        _nbMainThreads(0),
+        _stats(Threading::getMaxThreads())
     {
-        omp_init_lock(&_queueLock);
-        addMainThread(omp_get_thread_num());
+        if (QueueBackend::LOCKED == _backend)
+        {
+            nbSubQueues = 1;
+        }
+        else if (nbSubQueues <= 0)
+        {
+            nbSubQueues = (QueueBackend::MULTIQUEUE == _backend) ? 2 * Threading::getMaxThreads()
+                                                                 : Threading::getMaxThreads();
+        }
+        for (size_t i = 0; i < _nbOwners; i++)
+        {
+            _epochs[i] = 0;
+            _isMain[i] = false;
+        }
+        _preferredSubQueue.reset(new std::atomic<int>[nbSubQueues]);
+        for (int i = 0; i < nbSubQueues; i++)
+        {
+            _subQueues.push_back(std::unique_ptr<SubQueue>(new SubQueue()));
+            _preferredSubQueue[i] = i;
+        }
+        // The thread creating the queue is a main thread.
+        _isMain[Threading::getThreadNum() % _nbOwners] = true;
+        _nbMainThreads = 1;
+        updatePreferredSubQueues();
         //run();    // Do not start queue here: wait until we are in parallel zone.
     }
 
-    // Destructor, could be needed to destroy lock.
-    virtual ~Queue()
+    // Destructor. Locks are destroyed with the SubQueues.
+    virtual ~BasicQueue() {}
+
+    // Get/Set
+    int getQueueSize() const { return _queueSize; }
+    int getNbP1() const { return _nbP1; }
+    QueueBackend getBackend() const { return _backend; }
+    int getNbSubQueues() const { return int(_subQueues.size()); }
+    const PointArena& getArena() const { return _arena; }
+    size_t getDimension() const { return _arena.getDimension(); }
+    const Priority& getComp() const { return _comp; }
+
+    // Evaluator used by run(). MockEvaluator by default.
+    // Must be set before run() is called.
+    void setEvaluator(const std::shared_ptr<Evaluator>& evaluator) { _evaluator = evaluator; }
+    const std::shared_ptr<Evaluator>& getEvaluator() const { return _evaluator; }
+
+    // Asynchronous evaluation: if asyncEvaluator is not null, run() uses
+    // it instead of the Evaluator. Each thread keeps up to maxInFlight
+    // points in flight, so a few threads can keep many slow evaluations
+    // running. Null by default. Must be set before run() is called.
+    void setAsyncEvaluator(const std::shared_ptr<AsyncEvaluator>& asyncEvaluator, const size_t maxInFlight)
     {
-        omp_destroy_lock(&_queueLock);
+        _asyncEvaluator = asyncEvaluator;
+        _maxInFlight = (maxInFlight > 0) ? maxInFlight : 1;
     }
+    const std::shared_ptr<AsyncEvaluator>& getAsyncEvaluator() const { return _asyncEvaluator; }
+    size_t getMaxInFlight() const { return _maxInFlight; }
 
-    // Get/Set
-    int getQueueSize() const { return _queue.size(); }
+    // Cache of evaluations. A point with the same coordinates as a point
+    // already evaluated gets the cached evaluation, when it is added and
+    // when it is popped, instead of being evaluated again.
+    // Set to null to disable the cache.
+    void setCache(const std::shared_ptr<EvalCache>& cache) { _cache = cache; }
+    const std::shared_ptr<EvalCache>& getCache() const { return _cache; }
 
-    void addMainThread(const int threadNum)
+    // Journal of evaluations, kept in a file to restart a run that died.
+    // The evaluations already in the journal are loaded in the cache, so
+    // that the points they evaluated are not evaluated again, and the
+    // incumbent is set to the best of them. Set the cache before the
+    // journal. Return the number of evaluations loaded.
+    // Only evaluations are journaled, not the queue: the caller adds the
+    // points again, and addToQueue() only queues those that are not in
+    // the cache, i.e. that were not evaluated before.
+    // Every new evaluation is appended to the journal.
+    // Throws std::invalid_argument if the journal is not of the dimension
+    // of the queue. Set to null to stop journaling.
+    size_t setJournal(const std::shared_ptr<EvalJournal>& journal);
+    const std::shared_ptr<EvalJournal>& getJournal() const { return _journal; }
+
+    // Instrumentation: lock waits, pops, evaluations, idle time, queue
+    // depth and P1 phases, per thread. Disabled by default; when disabled,
+    // the queue does not read the clock. Must be set before run() is called.
+    // Use getStats().getSnapshot() or getStats().report() to read them.
+    void setStatsEnabled(const bool enabled) { _stats.setEnabled(enabled); }
+    const QueueStats& getStats() const { return _stats; }
+    void clearStats() { _stats.clear(); }
+
+    // Opportunistic evaluation: when a point is a success, the other points
+    // added by the same main thread are cancelled, and the main thread
+    // stops its run(). False by default.
+    void setOpportunistic(const bool opportunistic) { _opportunistic = opportunistic; }
+    bool getOpportunistic() const { return _opportunistic; }
+
+    // Best evaluation found so far by all threads, +infinity if none.
+    // An evaluation is a success if it is better than the best eval of
+    // its point and than the incumbent; the incumbent is then updated.
+    // Points with a lower bound that is not better than the incumbent are
+    // not evaluated: they are dropped when they are popped.
+    double getIncumbent() const { return _incumbent.load(std::memory_order_relaxed); }
+    void setIncumbent(const double incumbent) { _incumbent.store(incumbent, std::memory_order_relaxed); }
+    // Set the incumbent to eval if eval is better, atomically.
+    // Return true if the incumbent was updated.
+    bool updateIncumbent(const double eval);
+
+    // Epoch of the points added by thread threadNum.
+    // Threads with the same number modulo the maximum number of threads
+    // share the same epoch.
+    uint32_t getEpoch(const int threadNum) const { return _epochs[threadNum % _nbOwners]; }
+
+    // Cancel all points added by thread threadNum that are still in the
+    // queue, in O(1). Cancelled points are skipped when they are popped.
+    void cancelPoints(const int threadNum);
+    // Cancel all points added by the current thread.
+    void cancelPoints() { cancelPoints(Threading::getThreadNum()); }
+
+    // run() pops points by batches of at most maxBatchSize points.
+    // The batch size is adapted so that evaluating a batch takes about
+    // targetBatchTime seconds: many points when evaluations are short,
+    // a single point when evaluations are long.
+    void setBatchParameters(const size_t maxBatchSize, const double targetBatchTime)
+    {
+        _maxBatchSize = (maxBatchSize > 0) ? maxBatchSize : 1;
+        _targetBatchTime = targetBatchTime;
+    }
+
+    // Store a new point and return its handle. Thread-safe.
+    // The coordinates are copied into the queue's storage.
+    QueuePointHandle createPoint(const QueuePoint& point) { return _arena.create(point); }
+    QueuePointHandle createPoint(const std::vector<double>& coords, const double bestEval)
     {
-        _mainThreads.insert(threadNum);
-        MainThreadInfo threadInfo;
-        auto threadInfoPair = std::pair<const int, const MainThreadInfo&>(threadNum, threadInfo);
-        _mainThreadInfo.insert(threadInfoPair);
+        return _arena.create(QueuePoint(coords.data(), coords.size(), bestEval));
     }
-    bool isMainThread(const int threadNum) const { return (_mainThreads.end() != _mainThreads.find(threadNum)); }
-    const std::set<int>& getMainThreads() const { return _mainThreads; }
-    int getNbMainThreads() const { return int(_mainThreads.size()); }
+    // Access a point from its handle. The handle must be valid.
+    QueuePoint& getPoint(const QueuePointHandle& handle) { return _arena.get(handle); }
+    const QueuePoint& getPoint(const QueuePointHandle& handle) const { return _arena.get(handle); }
+    // Release a point: its storage may be reused. If the point is still
+    // in the queue, it will be skipped when popped.
+    bool releasePoint(const QueuePointHandle& handle) { return _arena.release(handle); }
+
+    // Roles of the threads. Main threads add points, and evaluate them
+    // with run() until stopMainEval() is true. Other threads evaluate the
+    // points with run() until all main threads are stopped.
+    // Roles may change at any time: a thread takes the main role with
+    // addMainThread(), and gives it up with stop(). It may then call run()
+    // to evaluate the points of the other main threads, instead of idling.
+    // The thread creating the queue is a main thread. Threads with the same
+    // number modulo the maximum number of threads share the same role.
+    // Thread-safe. Return false if the thread is already a main thread,
+    // or if all main threads are stopped.
+    bool addMainThread(const int threadNum);
+    bool addMainThread() { return addMainThread(Threading::getThreadNum()); }
+    bool isMainThread(const int threadNum) const { return _isMain[threadNum % _nbOwners].load(std::memory_order_relaxed); }
+    // Thread numbers of the current main threads.
+    std::vector<int> getMainThreads() const;
+    int getNbMainThreads() const { return _nbMainThreads; }
 
     // Other methods
 
@@ -81,19 +289,40 @@ public:
     void start() {}
     // Continuous evaluation
     bool run();
-    // Stop evaluation for the current thread (which should be a main thread)
+    // Stop evaluation for the current thread, which gives up the main role.
+    // When the last main thread stops, evaluation is done for all threads.
     void stop();
 
-    /// Sort the queue with respect to the comparison function comp.
-    void sort(LowerPriority comp);
+    /// Reorder the queue with respect to the comparison function comp.
+    /// comp becomes the comparison function used for subsequent insertions.
+    /// If comp has a cost function, the keys of all points are recomputed.
+    /// Throws std::invalid_argument if comp cannot order the points.
+    void sort(Priority comp);
 
-    /// Use the default comparison function _comp.
+    /// Recompute keys and reorder using the current comparison function _comp.
+    /// Must be called when the cost of the points changes, e.g. when the
+    /// direction used by the cost function changes.
     void sort() { sort(_comp); }
+
+    /// Same as sort(comp), without stopping the other threads: the keys
+    /// are recomputed on copies of the heaps, without holding the locks,
+    /// and the reordered heaps are then swapped in, holding all locks only
+    /// for the swap. Meanwhile, other threads keep adding and popping
+    /// points in the current order. Use it when the direction or the best
+    /// evaluation used by the cost function changes during the run.
+    /// If comp has no cost function, the comparisons cannot be done on
+    /// copies: same as sort(comp).
+    void rekey(Priority comp);
   
-    // Eval a single point (mock eval). Pop it from queue.
+    // Eval a single point with the evaluator. Pop it from queue.
     // Return true (success) if eval is better than point's best eval.
     bool evalSinglePoint();
 
+    // Pop at most maxNbPoints points with popBatch(), and eval them.
+    // nbPoints is the number of points popped.
+    // Return true (success) if an eval is better than its point's best eval.
+    bool evalBatch(const size_t maxNbPoints, size_t& nbPoints);
+
     // Did we reach a stop condition (for main thread)?
     bool stopMainEval() const;
 
@@ -103,15 +332,30 @@ public:
     // Notify the queue that we will add points.
     void startAdding();
     // Notify the queue that we are done adding points.
+    // Throws std::invalid_argument if the Priority cannot order them, see
+    // checkDimension(): they are then not added.
     void stopAdding();
-    // Add a single Point to the Queue
-    void addToQueue(const QueuePointPtr point);
+    // Add a single Point to the Queue.
+    // The point is staged by the current thread, without any lock, and
+    // inserted when stopAdding() is called: the keys of all added points
+    // are computed and the points sorted without any lock, then merged
+    // in the heaps with the lock held. Other threads keep popping points
+    // meanwhile, and several threads may add points at the same time.
+    void addToQueue(const QueuePointHandle& handle);
 
-    QueuePointPtr getTopPoint() const;
+    // Handle to the top point. Null handle if the queue is empty.
+    QueuePointHandle getTopPoint() const;
 
     // get the top Point from the queue and pop it.
     // Return true if it worked, false otherwise.
-    bool popPoint(QueuePointPtr &point);
+    bool popPoint(QueuePointHandle &handle);
+
+    // Get at most n top points from the queue and pop them, with a single
+    // lock acquisition. A batch never mixes P1 and non-P1 points.
+    // For MULTIQUEUE and PER_MAIN_THREAD backends, points are popped from
+    // a single SubQueue, so they are not exactly the top n points.
+    // Return the number of points popped.
+    size_t popBatch(const size_t n, std::vector<QueuePointHandle>& handles);
 
     // Display all points in the queue
     // Clear it at the same time.
@@ -120,7 +364,134 @@ public:
 
     void clearQueue();
 
+private:
+    // Lock a SubQueue, waiting for it if needed. Measures the wait
+    // when stats are enabled.
+    void lockSubQueue(SubQueue& subQueue) const;
+    // Lock/unlock all SubQueues, in order.
+    void lockAll() const;
+    void unlockAll() const;
+
+    // SubQueue to which the current thread adds points, for LOCKED and
+    // PER_MAIN_THREAD backends.
+    SubQueue& getOwnSubQueue() const;
+
+    // Assign each thread to the SubQueue of a main thread, for
+    // PER_MAIN_THREAD backend.
+    void updatePreferredSubQueues();
+
+    // Compute the keys of entries and insert them in the SubQueues.
+    // No SubQueue lock must be held by the current thread.
+    void publish(std::vector<QueueEntry>& entries);
+
+    // Entry of a batch with the same coordinates as another entry, which
+    // is evaluated instead.
+    class DuplicateEntry
+    {
+    public:
+        QueueEntry _entry;
+        QueuePointHandle _original;     // Point that is evaluated instead
+    };
+
+    // Keep one entry per distinct coordinates in entries, and move the
+    // other entries with the same coordinates to duplicates. The same
+    // point found several times is kept once, and is not a duplicate.
+    // The order of entries is changed.
+    void removeDuplicates(std::vector<QueueEntry>& entries, std::vector<DuplicateEntry>& duplicates) const;
+    // Give to a duplicate the evaluation of the point with the same
+    // coordinates, if it is evaluated and did not fail. It counts as a
+    // cache hit.
+    void setDuplicateEval(const DuplicateEntry& duplicate);
+    // Claim the points of entries in the cache, so that no other thread
+    // evaluates points with the same coordinates. Keep in entries the
+    // points claimed, which must then be evaluated; move to pending the
+    // points being evaluated by other threads. Points found in the cache
+    // get their evaluation; stale, pruned and evaluated points are dropped.
+    // Without cache, all points that are still to evaluate are kept.
+    void claimPoints(std::vector<QueueEntry>& entries, std::vector<QueueEntry>& pending);
+    // End the claims of points that will not be evaluated.
+    void releasePoints(const std::vector<QueueEntry>& entries);
+
+    // Eval points that were popped, in a single call to the evaluator.
+    // Points that are already evaluated are skipped, and points with the
+    // same coordinates, e.g. a point popped several times, are evaluated
+    // once.
+    // Return true (success) if an eval is better than its point's best eval.
+    bool evalPoints(const std::vector<QueueEntry>& entries);
+    // Set the evaluation of a point, and handle success and opportunism.
+    // If the point is already evaluated, e.g. by another thread, eval is
+    // dropped: it is not cached, not journaled, and not a success.
+    // A failed evaluation, NaN, is set but neither cached nor journaled,
+    // and the claim of the point is released.
+    // Return true (success) if eval is better than the point's best eval.
+    bool setEvalResult(const QueueEntry& entry, const double eval);
+    // run() with the AsyncEvaluator.
+    // As in evalPoints(), a point is in flight at most once, and points
+    // with the same coordinates are submitted once.
+    bool runAsync();
+    // Return true if the point does not need to be evaluated: it is
+    // already evaluated, or its evaluation is found in the cache.
+    bool evalFromCache(const QueuePointHandle& handle);
+
+    // Batch size for run(), given the average evaluation time per point.
+    size_t computeBatchSize(const double avgEvalTime) const;
+
+    // Entry for a point added by the current thread.
+    QueueEntry makeEntry(const QueuePointHandle& handle) const
+    {
+        const uint32_t owner = Threading::getThreadNum() % _nbOwners;
+        return QueueEntry(handle, _arena.get(handle).getP1(), owner, _epochs[owner]);
+    }
+
+    // Is the point of the entry released, or cancelled?
+    bool isStale(const QueueEntry& entry) const
+    {
+        return (entry.getEpoch() != _epochs[entry.getOwner()] || !_arena.isValid(entry.getHandle()));
+    }
+
+    // Is the point of the entry unable to beat the incumbent?
+    // The entry must not be stale.
+    bool isPruned(const QueueEntry& entry) const
+    {
+        return (_arena.get(entry.getHandle()).getLowerBound() >= getIncumbent());
+    }
+
+    // Is the entry neither stale nor pruned? Counts stale and pruned pops.
+    bool isLive(const QueueEntry& entry) const;
+
+    // Pop entries with popEntry() until one is not stale.
+    bool popLiveEntry(QueueEntry &entry);
+
+    // Pop at most n entries that are not stale, with a single lock
+    // acquisition. See popBatch().
+    size_t popEntries(const size_t n, std::vector<QueueEntry>& entries);
+
+    // Pop the top entry, using the pop method of the backend.
+    bool popEntry(QueueEntry &entry);
+
+    // Pop for MULTIQUEUE backend.
+    bool popEntryRelaxed(QueueEntry &entry);
+
+    // Pop for PER_MAIN_THREAD backend.
+    bool popEntryLocal(QueueEntry &entry);
+
+    // Pop a P1 entry, looking at all SubQueues starting at index start.
+    // Return false if no P1 entry was found.
+    bool popP1(QueueEntry &entry, const size_t start);
+
+    // Pop the top entry of SubQueue subQueue, which is locked and not empty.
+    void popFrom(SubQueue& subQueue, QueueEntry &entry);
+
+    // Wake up threads waiting for points in run().
+    void notifyWaitingThreads();
+
+    // Block the current thread until there are points in the queue,
+    // or until evaluation is done for all main threads.
+    void waitForPoints();
 
 };
 
+// Queue with type-erased comparison function.
+typedef BasicQueue<LowerPriority> Queue;
+
 #endif // __QUEUE_HPP__
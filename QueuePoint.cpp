@@ -1,2 +1,39 @@
 #include "QueuePoint.hpp"
 
+
+bool LowerPriority::operator()(const QueuePoint& p1, const QueuePoint& p2) const
+{
+    bool hasLowerPriority = false;
+
+    if (p1.getP1() != p2.getP1())
+    {
+        hasLowerPriority = (p1.getP1() < p2.getP1());
+    }
+    else if (hasCost())
+    {
+        PointBatch batch;
+        batch.add(p1);
+        batch.add(p2);
+        double costs[2];
+        _cost(batch, costs);
+        hasLowerPriority = (costs[0] > costs[1]);
+    }
+    else
+    {
+        hasLowerPriority = _comp(p1, p2);
+    }
+
+    return hasLowerPriority;
+}
+
+
+void LowerPriority::DefaultCost(const PointBatch& batch, double* costs)
+{
+    const double* bestEval = batch.getBestEval();
+    const size_t n = batch.size();
+    #pragma omp simd
+    for (size_t i = 0; i < n; i++)
+    {
+        costs[i] = bestEval[i];
+    }
+}
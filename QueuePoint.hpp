@@ -2,10 +2,13 @@
 #ifndef __QUEUEPOINT_HPP__
 #define __QUEUEPOINT_HPP__
 
+#include <atomic>
+#include <cstdint>      // For uint32_t
 #include <functional>   // For std::function
 #include <iostream>
-#include <memory>       // For shared_ptr
+#include <limits>       // For infinity
 #include <omp.h>
+#include <vector>
 
 class QueuePoint
 {
@@ -16,79 +19,289 @@ private:
     // of the Queue is related to that outside point class.
     // Not sure where _bestEval would reside.
     // _P1 remains here.
+    //
+    // QueuePoints are stored by value in a PointArena, so the layout is
+    // kept compact: the coordinates are not stored in the QueuePoint, but
+    // in a contiguous block of the PointArena.
 
-    // Point has 2 coordinates
-    double  _x;
-    double  _y;
-    // Value of evaluation
+    // Coordinates of the point. For a point stored in a PointArena, they
+    // belong to the arena. Otherwise, they belong to the caller, and must
+    // remain valid until the point is copied into a PointArena.
+    const double* _coords;
+    uint32_t _dimension;
+    // Value of evaluation. Valid once _evalState is EVALUATED: any value,
+    // including 0, is a valid evaluation.
     double _eval;
+    // NOT_EVALUATED, SETTING or EVALUATED. Atomic: a point may be read by
+    // a thread while another thread sets its evaluation.
+    std::atomic<uint32_t> _evalState;
     // Value to which evaluation will be compared
     double  _bestEval;
+    // Lower bound of the evaluation, e.g. from a model. The point is not
+    // evaluated if it cannot be better than the incumbent of the queue.
+    double _lowerBound;
+    // Flags, see below.
+    uint32_t _flags;
+
     // Is this a "priority 1" point to eval?
     // P1 points are always evaluated first, and the algorithm
     // only continues when all P1 points are evaluated / or when
     // a success is found.
-    bool _P1;
+    static const uint32_t P1_FLAG = 0x1;
+
+    static const uint32_t NOT_EVALUATED = 0;
+    static const uint32_t SETTING = 1;      // _eval is being written
+    static const uint32_t EVALUATED = 2;
 
 public:
-    QueuePoint(double x, double y, double bestEval)
-      : _x(x),
-        _y(y),
+    QueuePoint()
+      : _coords(nullptr),
+        _dimension(0),
+        _eval(0),
+        _evalState(NOT_EVALUATED),
+        _bestEval(0),
+        _lowerBound(-std::numeric_limits<double>::infinity()),
+        _flags(0)
+    {}
+
+    QueuePoint(const double* coords, const size_t dimension, const double bestEval)
+      : _coords(coords),
+        _dimension(uint32_t(dimension)),
         _eval(0),
+        _evalState(NOT_EVALUATED),
         _bestEval(bestEval),
-        _P1(false)
+        _lowerBound(-std::numeric_limits<double>::infinity()),
+        _flags(0)
     {}
 
+    QueuePoint(const QueuePoint& other)
+      : _coords(other._coords),
+        _dimension(other._dimension),
+        _eval(other.getEval()),
+        _evalState(other.isEvaluated() ? EVALUATED : NOT_EVALUATED),
+        _bestEval(other._bestEval),
+        _lowerBound(other._lowerBound),
+        _flags(other._flags)
+    {}
+
+    QueuePoint& operator=(const QueuePoint& other)
+    {
+        _coords = other._coords;
+        _dimension = other._dimension;
+        _eval = other.getEval();
+        _evalState.store(other.isEvaluated() ? EVALUATED : NOT_EVALUATED, std::memory_order_release);
+        _bestEval = other._bestEval;
+        _lowerBound = other._lowerBound;
+        _flags = other._flags;
+        return *this;
+    }
+
     // Get/Set
-    double getX() const { return _x; }
-    double getY() const { return _y; }
-    double getEval() const { return _eval; }
-    void setEval(const double eval) { _eval = eval; }
+    size_t getDimension() const { return _dimension; }
+    const double* getCoords() const { return _coords; }
+    double getCoord(const size_t i) const { return _coords[i]; }
+    // Make the point refer to other coordinates. Used by PointArena.
+    void setCoords(const double* coords) { _coords = coords; }
+    // Has the evaluation been set? It synchronizes with the thread that
+    // set it: getEval() may then be read.
+    bool isEvaluated() const { return (EVALUATED == _evalState.load(std::memory_order_acquire)); }
+    // Evaluation, 0 if the point is not evaluated.
+    double getEval() const { return isEvaluated() ? _eval : 0; }
+    // Set the evaluation. Not thread-safe: see setEvalIfNone().
+    void setEval(const double eval)
+    {
+        _eval = eval;
+        _evalState.store(EVALUATED, std::memory_order_release);
+    }
+    // Set the evaluation if the point is not evaluated yet. Of several
+    // threads evaluating the same point, only the first one sets it.
+    // Return false if the point was already evaluated.
+    bool setEvalIfNone(const double eval)
+    {
+        uint32_t state = NOT_EVALUATED;
+        if (!_evalState.compare_exchange_strong(state, SETTING, std::memory_order_acquire))
+        {
+            return false;
+        }
+        _eval = eval;
+        _evalState.store(EVALUATED, std::memory_order_release);
+        return true;
+    }
     double getBestEval() const { return _bestEval; }
-    void setP1(const bool p1) { _P1 = p1; }
-    bool getP1() const { return _P1; }
+    double getLowerBound() const { return _lowerBound; }
+    void setLowerBound(const double lowerBound) { _lowerBound = lowerBound; }
+    void setP1(const bool p1) { _flags = p1 ? (_flags | P1_FLAG) : (_flags & ~P1_FLAG); }
+    bool getP1() const { return (0 != (_flags & P1_FLAG)); }
 
 };
 
-typedef std::shared_ptr<QueuePoint> QueuePointPtr;
-
 std::ostream& operator<<(std::ostream& out, const QueuePoint& point);
 
 
-class LowerPriority {
+// Stable reference to a QueuePoint stored in a PointArena: index of
+// the point in the arena, and generation of the arena slot. The generation
+// changes when the point is released, so a handle to a released point
+// is detected instead of silently referring to a new point.
+class QueuePointHandle
+{
 private:
-    std::function<bool(QueuePointPtr &p1, QueuePointPtr &p2)> _comp;
+    uint32_t _index;
+    uint32_t _generation;
 
 public:
-    // Constructor
-    LowerPriority(const std::function<bool(QueuePointPtr &p1, QueuePointPtr &p2)> comp = std::function<bool(QueuePointPtr &p1, QueuePointPtr &p2)>(DefaultComp))
-      : _comp(comp)
+    static const uint32_t NULL_INDEX = 0xFFFFFFFF;
+
+    QueuePointHandle()
+      : _index(NULL_INDEX),
+        _generation(0)
     {}
 
+    QueuePointHandle(const uint32_t index, const uint32_t generation)
+      : _index(index),
+        _generation(generation)
+    {}
 
-    // Comparison operator for sorting queue points.
-    // Points P1 are always prioritary.
-    bool operator()(QueuePointPtr& p1, QueuePointPtr& p2)
+    // Get/Set
+    uint32_t getIndex() const { return _index; }
+    uint32_t getGeneration() const { return _generation; }
+    bool isNull() const { return (NULL_INDEX == _index); }
+
+    bool operator==(const QueuePointHandle& other) const
     {
-        bool hasLowerPriority = false;
-        
-        if (p1->getP1() != p2->getP1())
-        {
-            hasLowerPriority = (p1->getP1() < p2->getP1());
-        }
-        else
-        {
-            hasLowerPriority = _comp(p1, p2);
-        }
+        return (_index == other._index && _generation == other._generation);
+    }
+};
+
+
+// Coordinates and best evaluations of a batch of points, stored as
+// contiguous arrays so that computations on the batch can be vectorized.
+// Coordinates are stored point by point: the coordinates of point i are
+// getCoords(i)[0] to getCoords(i)[getDimension() - 1].
+// All points of a batch have the same dimension.
+class PointBatch
+{
+private:
+    size_t _dimension;
+    std::vector<double> _coords;
+    std::vector<double> _bestEval;
+
+public:
+    PointBatch()
+      : _dimension(0),
+        _coords(),
+        _bestEval()
+    {}
+
+    // Get/Set
+    size_t size() const { return _bestEval.size(); }
+    size_t getDimension() const { return _dimension; }
+    const double* getCoords() const { return _coords.data(); }
+    const double* getCoords(const size_t i) const { return _coords.data() + i * _dimension; }
+    const double* getBestEval() const { return _bestEval.data(); }
 
-        return hasLowerPriority;
+    void add(const QueuePoint& point)
+    {
+        _dimension = point.getDimension();
+        _coords.insert(_coords.end(), point.getCoords(), point.getCoords() + _dimension);
+        _bestEval.push_back(point.getBestEval());
+    }
+
+    void reserve(const size_t n, const size_t dimension)
+    {
+        _coords.reserve(n * dimension);
+        _bestEval.reserve(n);
+    }
+
+    void clear()
+    {
+        _coords.clear();
+        _bestEval.clear();
+    }
+};
+
+
+// Vectorized kernels on coordinates.
+
+// Dot product of a and b, of dimension n.
+inline double dot(const double* a, const double* b, const size_t n)
+{
+    double sum = 0.0;
+    #pragma omp simd reduction(+:sum)
+    for (size_t i = 0; i < n; i++)
+    {
+        sum += a[i] * b[i];
+    }
+    return sum;
+}
+
+// Square of the distance between a and b, of dimension n.
+inline double squaredDistance(const double* a, const double* b, const size_t n)
+{
+    double sum = 0.0;
+    #pragma omp simd reduction(+:sum)
+    for (size_t i = 0; i < n; i++)
+    {
+        double d = a[i] - b[i];
+        sum += d * d;
     }
+    return sum;
+}
+
+
+// Comparison function: true if p1 has a lower priority than p2.
+typedef std::function<bool(const QueuePoint& p1, const QueuePoint& p2)> CompFunction;
+// Cost function: compute the cost of each point of the batch, in costs.
+// The lower the cost, the higher the priority.
+typedef std::function<void(const PointBatch& batch, double* costs)> CostFunction;
+
+
+class LowerPriority {
+private:
+    CompFunction _comp;     // Used if _cost is not set
+    CostFunction _cost;     // If set, the queue computes a key for each point once, when it is added
+
+public:
+    // Constructor: order by cost, using DefaultCost.
+    LowerPriority()
+      : _comp(),
+        _cost(DefaultCost)
+    {}
+
+    // Constructor: order using a comparison function.
+    // The function is called each time two points are compared.
+    LowerPriority(const CompFunction comp)
+      : _comp(comp),
+        _cost()
+    {}
+
+    // Constructor: order by cost. The cost of each point is
+    // computed once, when it is added to the queue.
+    LowerPriority(const CostFunction cost)
+      : _comp(),
+        _cost(cost)
+    {}
+
+    // Get/Set
+    bool hasCost() const { return static_cast<bool>(_cost); }
+
+    // Compute the costs of the points of batch. hasCost() must be true.
+    void computeCosts(const PointBatch& batch, double* costs) const { _cost(batch, costs); }
+
+    // Points of any dimension can be ordered.
+    void checkDimension(const size_t) const {}
+
+    // Comparison operator for sorting queue points.
+    // Points P1 are always prioritary.
+    bool operator()(const QueuePoint& p1, const QueuePoint& p2) const;
 
     // Priority is lower if evaluation is higher.
-    static bool DefaultComp(QueuePointPtr& p1, QueuePointPtr& p2)
+    static bool DefaultComp(const QueuePoint& p1, const QueuePoint& p2)
     {
-        return (p1->getBestEval() > p2->getBestEval());
+        return (p1.getBestEval() > p2.getBestEval());
     }
+
+    // Same ordering as DefaultComp, as a cost.
+    static void DefaultCost(const PointBatch& batch, double* costs);
 };
 
 
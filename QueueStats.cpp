@@ -0,0 +1,284 @@
+#include "QueueStats.hpp"
+
+#include <algorithm>    // For max
+#include <cmath>        // For frexp, ldexp
+#include <iomanip>      // For setw
+
+
+Histogram::Histogram()
+  : _nbValues(0),
+    _sum(0.0),
+    _max(0.0)
+{
+    for (size_t i = 0; i < NB_BUCKETS; i++)
+    {
+        _counts[i] = 0;
+    }
+}
+
+
+Histogram::Histogram(const Histogram& other)
+  : Histogram()
+{
+    merge(other);
+}
+
+
+Histogram& Histogram::operator=(const Histogram& other)
+{
+    if (this != &other)
+    {
+        clear();
+        merge(other);
+    }
+    return *this;
+}
+
+
+void Histogram::add(const double value)
+{
+    size_t bucket = 0;
+    if (value >= 1.0)
+    {
+        // value is in [2^(exponent-1), 2^exponent).
+        int exponent = 0;
+        std::frexp(value, &exponent);
+        bucket = std::min(size_t(exponent), NB_BUCKETS - 1);
+    }
+    _counts[bucket].store(_counts[bucket].load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    _nbValues.store(_nbValues.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    _sum.store(_sum.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+    if (value > _max.load(std::memory_order_relaxed))
+    {
+        _max.store(value, std::memory_order_relaxed);
+    }
+}
+
+
+void Histogram::merge(const Histogram& other)
+{
+    for (size_t i = 0; i < NB_BUCKETS; i++)
+    {
+        _counts[i].store(_counts[i].load(std::memory_order_relaxed) + other._counts[i].load(std::memory_order_relaxed), std::memory_order_relaxed);
+    }
+    _nbValues.store(getNbValues() + other.getNbValues(), std::memory_order_relaxed);
+    _sum.store(getSum() + other.getSum(), std::memory_order_relaxed);
+    _max.store(std::max(getMax(), other.getMax()), std::memory_order_relaxed);
+}
+
+
+void Histogram::clear()
+{
+    for (size_t i = 0; i < NB_BUCKETS; i++)
+    {
+        _counts[i].store(0, std::memory_order_relaxed);
+    }
+    _nbValues.store(0, std::memory_order_relaxed);
+    _sum.store(0.0, std::memory_order_relaxed);
+    _max.store(0.0, std::memory_order_relaxed);
+}
+
+
+double Histogram::getMean() const
+{
+    uint64_t nbValues = getNbValues();
+    return (0 == nbValues) ? 0.0 : getSum() / double(nbValues);
+}
+
+
+double Histogram::getPercentile(const double p) const
+{
+    uint64_t nbValues = getNbValues();
+    if (0 == nbValues)
+    {
+        return 0.0;
+    }
+
+    // Rank of the percentile, from 1 to nbValues.
+    uint64_t rank = std::max(uint64_t(1), uint64_t(std::ceil(p / 100.0 * double(nbValues))));
+    uint64_t nbSeen = 0;
+    for (size_t i = 0; i < NB_BUCKETS; i++)
+    {
+        nbSeen += _counts[i].load(std::memory_order_relaxed);
+        if (nbSeen >= rank)
+        {
+            // Upper bound of bucket i, but never more than the maximum.
+            return std::min(std::ldexp(1.0, int(i)), getMax());
+        }
+    }
+    return getMax();
+}
+
+
+ThreadStats::ThreadStats()
+  : _nbPops(0),
+    _nbStalePops(0),
+    _nbPrunedPops(0),
+    _nbEvals(0),
+    _nbCacheHits(0),
+    _nbLocks(0),
+    _nbContendedLocks(0),
+    _evalTime(0.0),
+    _idleTime(0.0),
+    _lockWait(),
+    _sortHold(),
+    _queueDepth(),
+    _p1Phase()
+{
+}
+
+
+ThreadStats::ThreadStats(const ThreadStats& other)
+  : ThreadStats()
+{
+    merge(other);
+}
+
+
+ThreadStats& ThreadStats::operator=(const ThreadStats& other)
+{
+    if (this != &other)
+    {
+        clear();
+        merge(other);
+    }
+    return *this;
+}
+
+
+void ThreadStats::merge(const ThreadStats& other)
+{
+    add(_nbPops, other.getNbPops());
+    add(_nbStalePops, other.getNbStalePops());
+    add(_nbPrunedPops, other.getNbPrunedPops());
+    add(_nbEvals, other.getNbEvals());
+    add(_nbCacheHits, other.getNbCacheHits());
+    add(_nbLocks, other.getNbLocks());
+    add(_nbContendedLocks, other.getNbContendedLocks());
+    add(_evalTime, other.getEvalTime());
+    add(_idleTime, other.getIdleTime());
+    _lockWait.merge(other._lockWait);
+    _sortHold.merge(other._sortHold);
+    _queueDepth.merge(other._queueDepth);
+    _p1Phase.merge(other._p1Phase);
+}
+
+
+void ThreadStats::clear()
+{
+    _nbPops = 0;
+    _nbStalePops = 0;
+    _nbPrunedPops = 0;
+    _nbEvals = 0;
+    _nbCacheHits = 0;
+    _nbLocks = 0;
+    _nbContendedLocks = 0;
+    _evalTime = 0.0;
+    _idleTime = 0.0;
+    _lockWait.clear();
+    _sortHold.clear();
+    _queueDepth.clear();
+    _p1Phase.clear();
+}
+
+
+QueueStats::QueueStats(const size_t nbThreads)
+  : _enabled(false),
+    _nbThreads(std::max(nbThreads, size_t(1))),
+    _threadStats(new ThreadStats[_nbThreads]),
+    _p1PhaseStart(0.0),
+    _startTime(omp_get_wtime())
+{
+}
+
+
+void QueueStats::startP1Phase()
+{
+    double noPhase = 0.0;
+    _p1PhaseStart.compare_exchange_strong(noPhase, omp_get_wtime());
+}
+
+
+void QueueStats::endP1Phase()
+{
+    double phaseStart = _p1PhaseStart.exchange(0.0);
+    if (phaseStart > 0.0)
+    {
+        getLocal().addP1Phase(omp_get_wtime() - phaseStart);
+    }
+}
+
+
+std::vector<ThreadStats> QueueStats::getSnapshot() const
+{
+    return std::vector<ThreadStats>(_threadStats.get(), _threadStats.get() + _nbThreads);
+}
+
+
+ThreadStats QueueStats::getTotal() const
+{
+    ThreadStats total;
+    for (size_t i = 0; i < _nbThreads; i++)
+    {
+        total.merge(_threadStats[i]);
+    }
+    return total;
+}
+
+
+// Display a histogram of durations in ns as microseconds.
+static void displayTimes(std::ostream& os, const std::string& name, const Histogram& histogram)
+{
+    os << name << ": n=" << histogram.getNbValues()
+       << " mean=" << histogram.getMean() / 1000.0 << "us"
+       << " p50=" << histogram.getPercentile(50) / 1000.0 << "us"
+       << " p99=" << histogram.getPercentile(99) / 1000.0 << "us"
+       << " max=" << histogram.getMax() / 1000.0 << "us" << std::endl;
+}
+
+
+void QueueStats::report(std::ostream& os) const
+{
+    const double elapsed = omp_get_wtime() - _startTime;
+    os << "Queue statistics over " << elapsed << "s" << std::endl;
+    os << std::setw(7) << "Thread" << std::setw(10) << "Pops" << std::setw(10) << "Stale"
+       << std::setw(10) << "Pruned" << std::setw(10) << "Evals" << std::setw(10) << "CacheHits"
+       << std::setw(10) << "Locks" << std::setw(11) << "Contended"
+       << std::setw(12) << "Evals/s" << std::setw(12) << "EvalTime" << std::setw(12) << "IdleTime" << std::endl;
+    for (size_t i = 0; i < _nbThreads; i++)
+    {
+        const ThreadStats& stats = _threadStats[i];
+        if (0 == stats.getNbPops() && 0 == stats.getNbLocks() && 0.0 == stats.getIdleTime())
+        {
+            // Thread not used.
+            continue;
+        }
+        os << std::setw(7) << i << std::setw(10) << stats.getNbPops() << std::setw(10) << stats.getNbStalePops()
+           << std::setw(10) << stats.getNbPrunedPops() << std::setw(10) << stats.getNbEvals() << std::setw(10) << stats.getNbCacheHits()
+           << std::setw(10) << stats.getNbLocks() << std::setw(11) << stats.getNbContendedLocks()
+           << std::setw(12) << (elapsed > 0.0 ? double(stats.getNbEvals()) / elapsed : 0.0)
+           << std::setw(12) << stats.getEvalTime() << std::setw(12) << stats.getIdleTime() << std::endl;
+    }
+
+    ThreadStats total = getTotal();
+    os << "Total: " << total.getNbPops() << " pops, " << total.getNbStalePops() << " stale, "
+       << total.getNbPrunedPops() << " pruned, " << total.getNbEvals() << " evals, " << total.getNbCacheHits() << " cache hits, "
+       << (elapsed > 0.0 ? double(total.getNbEvals()) / elapsed : 0.0) << " evals/s" << std::endl;
+    displayTimes(os, "Lock wait", total.getLockWait());
+    displayTimes(os, "Sort lock hold", total.getSortHold());
+    displayTimes(os, "P1 phase", total.getP1Phase());
+    const Histogram& depth = total.getQueueDepth();
+    os << "Queue depth at pop: mean=" << depth.getMean() << " p50=" << depth.getPercentile(50)
+       << " p99=" << depth.getPercentile(99) << " max=" << depth.getMax() << std::endl;
+}
+
+
+void QueueStats::clear()
+{
+    for (size_t i = 0; i < _nbThreads; i++)
+    {
+        _threadStats[i].clear();
+    }
+    _p1PhaseStart = 0.0;
+    _startTime = omp_get_wtime();
+}
@@ -0,0 +1,173 @@
+#ifndef __QUEUESTATS_HPP__
+#define __QUEUESTATS_HPP__
+
+#include <atomic>
+#include <cstdint>      // For uint64_t
+#include <iostream>
+#include <memory>
+#include <omp.h>
+#include <vector>
+
+#include "Threading.hpp"
+
+// Histogram of non-negative values, with power-of-two buckets:
+// bucket 0 holds values below 1, bucket i holds values in [2^(i-1), 2^i).
+// A histogram is written by a single thread, and may be read by any thread.
+// Copying a histogram gives a snapshot of its values.
+class Histogram
+{
+public:
+    static const size_t NB_BUCKETS = 48;
+
+private:
+    std::atomic<uint64_t> _counts[NB_BUCKETS];
+    std::atomic<uint64_t> _nbValues;
+    std::atomic<double> _sum;
+    std::atomic<double> _max;
+
+public:
+    // Constructor
+    explicit Histogram();
+    Histogram(const Histogram& other);
+    Histogram& operator=(const Histogram& other);
+
+    // Add a value. Only called by the thread owning the histogram.
+    void add(const double value);
+    // Add the values of the other histogram.
+    void merge(const Histogram& other);
+    void clear();
+
+    // Get/Set
+    uint64_t getNbValues() const { return _nbValues.load(std::memory_order_relaxed); }
+    double getSum() const { return _sum.load(std::memory_order_relaxed); }
+    double getMax() const { return _max.load(std::memory_order_relaxed); }
+    double getMean() const;
+    // Upper bound of the bucket holding the p-th percentile (p in [0, 100]).
+    double getPercentile(const double p) const;
+};
+
+
+// Counters of a single thread. Times are in seconds, except for
+// histograms of short durations, which are in nanoseconds.
+// Copying gives a snapshot of the counters.
+class alignas(64) ThreadStats
+{
+private:
+    std::atomic<uint64_t> _nbPops;          // Points popped from the queue, including stale ones
+    std::atomic<uint64_t> _nbStalePops;     // Points popped, but cancelled or released
+    std::atomic<uint64_t> _nbPrunedPops;    // Points popped, but not better than the incumbent
+    std::atomic<uint64_t> _nbEvals;         // Points given to the evaluator
+    std::atomic<uint64_t> _nbCacheHits;     // Points evaluated from the cache
+    std::atomic<uint64_t> _nbLocks;         // SubQueue locks acquired with lock()
+    std::atomic<uint64_t> _nbContendedLocks;    // Locks that were not immediately available
+    std::atomic<double> _evalTime;          // Time spent in the evaluator
+    std::atomic<double> _idleTime;          // Time spent waiting for points
+    Histogram _lockWait;                    // Time waiting for a SubQueue lock, in ns
+    Histogram _sortHold;                    // Time holding all locks in sort(), in ns
+    Histogram _queueDepth;                  // Queue size when popping
+    Histogram _p1Phase;                     // Duration of P1 phases ended by this thread, in ns
+
+    // Values are only written by the thread owning the counters:
+    // no need for an atomic read-modify-write.
+    template <typename T>
+    static void add(std::atomic<T>& counter, const T value)
+    {
+        counter.store(counter.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+    }
+
+public:
+    // Constructor
+    explicit ThreadStats();
+    ThreadStats(const ThreadStats& other);
+    ThreadStats& operator=(const ThreadStats& other);
+
+    void addPop(const int queueDepth)
+    {
+        add(_nbPops, uint64_t(1));
+        _queueDepth.add(double(queueDepth));
+    }
+    void addStalePop() { add(_nbStalePops, uint64_t(1)); }
+    void addPrunedPop() { add(_nbPrunedPops, uint64_t(1)); }
+    void addEvals(const size_t nbEvals, const double evalTime)
+    {
+        add(_nbEvals, uint64_t(nbEvals));
+        add(_evalTime, evalTime);
+    }
+    void addCacheHit() { add(_nbCacheHits, uint64_t(1)); }
+    void addLockWait(const double waitTime, const bool contended)
+    {
+        add(_nbLocks, uint64_t(1));
+        if (contended)
+        {
+            add(_nbContendedLocks, uint64_t(1));
+        }
+        _lockWait.add(waitTime * 1e9);
+    }
+    void addSortHold(const double holdTime) { _sortHold.add(holdTime * 1e9); }
+    void addIdle(const double idleTime) { add(_idleTime, idleTime); }
+    void addP1Phase(const double phaseTime) { _p1Phase.add(phaseTime * 1e9); }
+
+    // Add the counters of the other thread.
+    void merge(const ThreadStats& other);
+    void clear();
+
+    // Get/Set
+    uint64_t getNbPops() const { return _nbPops.load(std::memory_order_relaxed); }
+    uint64_t getNbStalePops() const { return _nbStalePops.load(std::memory_order_relaxed); }
+    uint64_t getNbPrunedPops() const { return _nbPrunedPops.load(std::memory_order_relaxed); }
+    uint64_t getNbEvals() const { return _nbEvals.load(std::memory_order_relaxed); }
+    uint64_t getNbCacheHits() const { return _nbCacheHits.load(std::memory_order_relaxed); }
+    uint64_t getNbLocks() const { return _nbLocks.load(std::memory_order_relaxed); }
+    uint64_t getNbContendedLocks() const { return _nbContendedLocks.load(std::memory_order_relaxed); }
+    double getEvalTime() const { return _evalTime.load(std::memory_order_relaxed); }
+    double getIdleTime() const { return _idleTime.load(std::memory_order_relaxed); }
+    const Histogram& getLockWait() const { return _lockWait; }
+    const Histogram& getSortHold() const { return _sortHold; }
+    const Histogram& getQueueDepth() const { return _queueDepth; }
+    const Histogram& getP1Phase() const { return _p1Phase; }
+};
+
+
+// Instrumentation of a Queue: one ThreadStats per thread.
+// Disabled by default. When disabled, the queue only checks isEnabled()
+// on its hot paths: no clock is read and no counter is written.
+class QueueStats
+{
+private:
+    bool _enabled;
+    size_t _nbThreads;
+    std::unique_ptr<ThreadStats[]> _threadStats;   // Indexed by thread number modulo _nbThreads
+    std::atomic<double> _p1PhaseStart;      // Start time of the current P1 phase, 0 if none
+    double _startTime;                      // Time of creation or of the last clear()
+
+public:
+    // Constructor
+    explicit QueueStats(const size_t nbThreads);
+
+    // Must be set before the queue is used by several threads.
+    void setEnabled(const bool enabled) { _enabled = enabled; }
+    bool isEnabled() const { return _enabled; }
+
+    // Counters of the current thread.
+    // Threads with the same number modulo the maximum number of threads
+    // share the same counters.
+    ThreadStats& getLocal() { return _threadStats[Threading::getThreadNum() % _nbThreads]; }
+
+    // A P1 phase starts when the first P1 point is added to an empty queue,
+    // and ends when there are no more P1 points in the queue.
+    void startP1Phase();
+    void endP1Phase();
+
+    // Snapshot of the counters of each thread.
+    std::vector<ThreadStats> getSnapshot() const;
+    // Snapshot of the counters of all threads together.
+    ThreadStats getTotal() const;
+
+    // Display the counters of each thread and the totals.
+    void report(std::ostream& os) const;
+
+    void clear();
+};
+
+
+#endif // __QUEUESTATS_HPP__
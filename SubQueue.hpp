@@ -0,0 +1,510 @@
+#ifndef __SUBQUEUE_HPP__
+#define __SUBQUEUE_HPP__
+
+#include <algorithm>    // For push_heap, pop_heap, make_heap, find_if, max
+#include <cstring>      // For memcpy
+#include <map>
+#include <tuple>        // For tie
+#include <vector>
+
+#include "PointArena.hpp"
+
+// Element of a SubQueue: a small POD referring to a point in the arena,
+// with a precomputed priority key.
+// The key is compared as a plain integer: the higher the key, the higher
+// the priority. Its highest bit is the P1 flag, so that P1 entries always
+// come first. The other bits come from the cost of the point, if the
+// LowerPriority has a cost function. The P1 flag is copied here when the
+// point is added, so that the queue can keep count of P1 points even if
+// the point is released meanwhile.
+// The owner is the thread that added the point, and the epoch is the
+// owner's epoch at that time. When the owner's epoch changes, all its
+// entries become stale and are skipped when popped.
+class QueueEntry
+{
+private:
+    uint64_t _key;
+    QueuePointHandle _handle;
+    uint32_t _owner;
+    uint32_t _epoch;
+
+    static const uint64_t P1_BIT = uint64_t(1) << 63;
+
+public:
+    QueueEntry()
+      : _key(0),
+        _handle(),
+        _owner(0),
+        _epoch(0)
+    {}
+
+    QueueEntry(const QueuePointHandle& handle, const bool p1,
+               const uint32_t owner, const uint32_t epoch)
+      : _key(p1 ? P1_BIT : 0),
+        _handle(handle),
+        _owner(owner),
+        _epoch(epoch)
+    {}
+
+    // Get/Set
+    const QueuePointHandle& getHandle() const { return _handle; }
+    uint32_t getOwner() const { return _owner; }
+    uint32_t getEpoch() const { return _epoch; }
+    uint64_t getKey() const { return _key; }
+    bool getP1() const { return (0 != (_key & P1_BIT)); }
+    void setP1(const bool p1) { _key = p1 ? (_key | P1_BIT) : (_key & ~P1_BIT); }
+
+    // Set the priority part of the key from the cost.
+    // The lower the cost, the higher the key.
+    void setCost(const double cost)
+    {
+        // Map the double to an unsigned integer with the same ordering,
+        // then reverse it. The lowest bit is dropped to make room for P1.
+        uint64_t bits;
+        std::memcpy(&bits, &cost, sizeof(bits));
+        bits = (0 != (bits & P1_BIT)) ? ~bits : (bits | P1_BIT);
+        _key = (_key & P1_BIT) | ((~bits) >> 1);
+    }
+};
+
+
+// Comparison of queue entries.
+// Priority is LowerPriority, or a StaticLowerPriority.
+// If the Priority has a cost function, only keys are compared.
+// Otherwise, P1 entries come first, then the comparison function is
+// called on the points the entries refer to.
+template <typename Priority>
+class EntryPriority
+{
+private:
+    const PointArena& _arena;
+    const Priority& _comp;
+
+public:
+    EntryPriority(const PointArena& arena, const Priority& comp)
+      : _arena(arena),
+        _comp(comp)
+    {}
+
+    bool operator()(const QueueEntry& e1, const QueueEntry& e2) const
+    {
+        if (_comp.hasCost() || e1.getP1() != e2.getP1())
+        {
+            return (e1.getKey() < e2.getKey());
+        }
+        return _comp(_arena.get(e1.getHandle()), _arena.get(e2.getHandle()));
+    }
+
+    // Compute the keys of entries, in a single call to the cost function.
+    // Nothing to do if the Priority has no cost function.
+    void computeKeys(std::vector<QueueEntry>& entries) const
+    {
+        computeKeys(entries.data(), entries.size());
+    }
+
+    // Compute the keys of the n entries starting at entries.
+    // Throws std::invalid_argument if the points cannot be ordered, see
+    // checkDimension() of the Priority. Without cost function, only this
+    // check is done, so that comparisons never throw in the heaps.
+    void computeKeys(QueueEntry* entries, const size_t n) const
+    {
+        if (0 == n)
+        {
+            return;
+        }
+        if (!_comp.hasCost())
+        {
+            _comp.checkDimension(_arena.getDimension());
+            return;
+        }
+
+        // Gather the points in contiguous arrays, so that the cost function
+        // may use vectorized kernels.
+        PointBatch batch;
+        batch.reserve(n, _arena.getDimension());
+        for (size_t i = 0; i < n; i++)
+        {
+            batch.add(_arena.get(entries[i].getHandle()));
+        }
+        std::vector<double> costs(n);
+        _comp.computeCosts(batch, costs.data());
+
+        for (size_t i = 0; i < n; i++)
+        {
+            entries[i].setCost(costs[i]);
+        }
+    }
+};
+
+
+// Queue entries protected by a lock, in two tiers: a binary heap of
+// P1 entries, and a binary heap of the other entries. P1 entries always
+// come first, so the P1 tier is looked at first.
+// The Queue is made of one or more SubQueues.
+// Methods other than lock(), tryLock() and unlock() must be called
+// with the lock held. The heaps are ordered with an EntryPriority, given
+// as a template parameter so that comparisons are inlined.
+//
+// The heaps may be re-keyed without holding the lock during the whole
+// operation: startRekey() copies the heaps, the keys of the copies are
+// computed and the copies are ordered while the SubQueue is still used,
+// and finishRekey() swaps them in. Entries pushed meanwhile are added to
+// the new heaps. Entries popped meanwhile are still in the new heaps:
+// they are marked as removed, and dropped when they reach the top.
+class SubQueue
+{
+private:
+    // Identity of an entry, to find the entries popped during a re-key.
+    class EntryId
+    {
+    public:
+        uint32_t _index;
+        uint32_t _generation;
+        uint32_t _owner;
+        uint32_t _epoch;
+
+        explicit EntryId(const QueueEntry& entry)
+          : _index(entry.getHandle().getIndex()),
+            _generation(entry.getHandle().getGeneration()),
+            _owner(entry.getOwner()),
+            _epoch(entry.getEpoch())
+        {}
+
+        bool operator<(const EntryId& other) const
+        {
+            return (std::tie(_index, _generation, _owner, _epoch)
+                    < std::tie(other._index, other._generation, other._owner, other._epoch));
+        }
+    };
+
+    std::vector<QueueEntry> _p1Heap;    // P1 entries. Top entry is at front
+    std::vector<QueueEntry> _heap;      // Other entries. Top entry is at front
+    bool _rekeying;                     // Between startRekey() and finishRekey()
+    bool _rekeyAborted;                 // The heaps were changed other than by push() and pop() during the re-key
+    std::vector<QueueEntry> _pushedDuringRekey;
+    std::vector<QueueEntry> _poppedDuringRekey;
+    std::map<EntryId, size_t> _removed; // Entries in the heaps that were already popped, with their count
+    size_t _nbRemovedP1;                // Number of removed entries in _p1Heap
+    size_t _nbRemoved;                  // Number of removed entries in _heap
+    mutable omp_lock_t _lock;
+
+    // Heap in which the top entry is.
+    std::vector<QueueEntry>& topHeap() { return _p1Heap.empty() ? _heap : _p1Heap; }
+
+    // Drop the removed entries from the top of the heaps, so that the top
+    // entry is never a removed one.
+    template <typename EntryComp>
+    void dropRemovedTop(const EntryComp& comp)
+    {
+        while (!_removed.empty() && !empty())
+        {
+            auto it = _removed.find(EntryId(top()));
+            if (_removed.end() == it)
+            {
+                break;
+            }
+            std::vector<QueueEntry>& heap = topHeap();
+            (&heap == &_p1Heap) ? _nbRemovedP1-- : _nbRemoved--;
+            std::pop_heap(heap.begin(), heap.end(), comp);
+            if (_rekeying)
+            {
+                // The entry is also in the copies made by startRekey().
+                _poppedDuringRekey.push_back(heap.back());
+            }
+            heap.pop_back();
+            if (0 == --it->second)
+            {
+                _removed.erase(it);
+            }
+        }
+    }
+
+    // Make room for n more entries in v, growing it geometrically as
+    // push_back does.
+    static void reserveMore(std::vector<QueueEntry>& v, const size_t n)
+    {
+        if (v.size() + n > v.capacity())
+        {
+            v.reserve(std::max(2 * v.capacity(), v.size() + n));
+        }
+    }
+
+    // Insert the entries [first, last) in heap: push them one by one if
+    // there are few of them, O(k log n). Otherwise rebuild, O(n + k).
+    template <typename Iterator, typename EntryComp>
+    static void insertAll(std::vector<QueueEntry>& heap, Iterator first, Iterator last, const EntryComp& comp)
+    {
+        const size_t k = size_t(last - first);
+        const size_t n = heap.size() + k;
+        size_t log2n = 1;
+        while ((size_t(1) << log2n) < n)
+        {
+            log2n++;
+        }
+        heap.insert(heap.end(), first, last);
+        if (k * log2n < n)
+        {
+            for (auto it = heap.end() - k; it != heap.end(); ++it)
+            {
+                std::push_heap(heap.begin(), it + 1, comp);
+            }
+        }
+        else
+        {
+            std::make_heap(heap.begin(), heap.end(), comp);
+        }
+    }
+
+    // Insert the entries [first, last), sorted from the highest to the
+    // lowest priority, in heap. A sorted range is a heap: if heap is
+    // empty, it is used as is.
+    template <typename Iterator, typename EntryComp>
+    static void mergeSorted(std::vector<QueueEntry>& heap, Iterator first, Iterator last, const EntryComp& comp)
+    {
+        if (heap.empty())
+        {
+            heap.assign(first, last);
+        }
+        else
+        {
+            insertAll(heap, first, last, comp);
+        }
+    }
+
+public:
+    // Constructor
+    explicit SubQueue()
+      : _p1Heap(),
+        _heap(),
+        _rekeying(false),
+        _rekeyAborted(false),
+        _pushedDuringRekey(),
+        _poppedDuringRekey(),
+        _removed(),
+        _nbRemovedP1(0),
+        _nbRemoved(0),
+        _lock()
+    {
+        omp_init_lock(&_lock);
+    }
+
+    // Destructor
+    virtual ~SubQueue()
+    {
+        omp_destroy_lock(&_lock);
+    }
+
+    // The lock cannot be copied.
+    SubQueue(const SubQueue&) = delete;
+    SubQueue& operator=(const SubQueue&) = delete;
+
+    void lock() const { omp_set_lock(&_lock); }
+    bool tryLock() const { return omp_test_lock(&_lock); }
+    void unlock() const { omp_unset_lock(&_lock); }
+
+    // Get/Set
+    bool empty() const { return _p1Heap.empty() && _heap.empty(); }
+    size_t size() const { return _p1Heap.size() + _heap.size() - _nbRemovedP1 - _nbRemoved; }
+    size_t getNbP1() const { return _p1Heap.size() - _nbRemovedP1; }
+    const QueueEntry& top() const { return _p1Heap.empty() ? _heap.front() : _p1Heap.front(); }
+
+    // Insert an entry in its tier. Cost is O(log n).
+    // The entry is not inserted if it throws.
+    template <typename EntryComp>
+    void push(const QueueEntry& entry, const EntryComp& comp)
+    {
+        std::vector<QueueEntry>& heap = entry.getP1() ? _p1Heap : _heap;
+        if (_rekeying)
+        {
+            reserveMore(_pushedDuringRekey, 1);
+        }
+        heap.push_back(entry);
+        std::push_heap(heap.begin(), heap.end(), comp);
+        if (_rekeying)
+        {
+            _pushedDuringRekey.push_back(entry);
+        }
+        dropRemovedTop(comp);
+    }
+
+    // Insert entries sorted from the highest to the lowest priority with
+    // respect to comp, e.g. a batch of added points. Cost is O(k log n)
+    // for k entries, or O(n + k), whichever is lower. A sorted batch
+    // inserted in an empty tier is used as the heap as is.
+    // Either all entries are inserted, or none if it throws.
+    template <typename EntryComp>
+    void merge(const std::vector<QueueEntry>& entries, const EntryComp& comp)
+    {
+        // P1 entries come first.
+        auto firstNonP1 = std::find_if(entries.begin(), entries.end(),
+                                       [](const QueueEntry& entry) { return !entry.getP1(); });
+        // Allocate first: if it throws, no entry is inserted.
+        reserveMore(_p1Heap, size_t(firstNonP1 - entries.begin()));
+        reserveMore(_heap, size_t(entries.end() - firstNonP1));
+        if (_rekeying)
+        {
+            reserveMore(_pushedDuringRekey, entries.size());
+        }
+        mergeSorted(_p1Heap, entries.begin(), firstNonP1, comp);
+        mergeSorted(_heap, firstNonP1, entries.end(), comp);
+        if (_rekeying)
+        {
+            _pushedDuringRekey.insert(_pushedDuringRekey.end(), entries.begin(), entries.end());
+        }
+        // make_heap() in insertAll() may reorder the whole heap: check
+        // the new top against the removed entries.
+        dropRemovedTop(comp);
+    }
+
+    // Remove the top entry and return it in entry.
+    // The SubQueue must not be empty.
+    template <typename EntryComp>
+    void pop(QueueEntry& entry, const EntryComp& comp)
+    {
+        // Move top element to the back, then remove it.
+        std::vector<QueueEntry>& heap = topHeap();
+        std::pop_heap(heap.begin(), heap.end(), comp);
+        entry = heap.back();
+        heap.pop_back();
+        if (_rekeying)
+        {
+            _poppedDuringRekey.push_back(entry);
+        }
+        dropRemovedTop(comp);
+    }
+
+    // Recompute the keys of all entries, and reorder the heaps
+    // with respect to comp.
+    template <typename EntryComp>
+    void rekey(const EntryComp& comp)
+    {
+        _rekeyAborted = _rekeying;
+        comp.computeKeys(_p1Heap);
+        std::make_heap(_p1Heap.begin(), _p1Heap.end(), comp);
+        comp.computeKeys(_heap);
+        std::make_heap(_heap.begin(), _heap.end(), comp);
+        dropRemovedTop(comp);
+    }
+
+    // Start a re-key: copy the heaps to p1Heap and heap. Their keys may
+    // then be computed and the copies ordered without holding the lock.
+    void startRekey(std::vector<QueueEntry>& p1Heap, std::vector<QueueEntry>& heap)
+    {
+        p1Heap = _p1Heap;
+        heap = _heap;
+        _rekeying = true;
+        _rekeyAborted = false;
+        _pushedDuringRekey.clear();
+        _poppedDuringRekey.clear();
+    }
+
+    // Replace the heaps with p1Heap and heap, copied by startRekey() and
+    // ordered with respect to comp. The entries pushed since startRekey()
+    // get their keys from comp and are added to the new heaps; the entries
+    // popped since are marked as removed. Cost is O(k log n), for k
+    // entries pushed or popped since startRekey().
+    // If the heaps were changed otherwise since startRekey(), e.g. by
+    // setAllP1ToFalse(), the copies are dropped and all keys are
+    // recomputed by rekey().
+    template <typename EntryComp>
+    void finishRekey(std::vector<QueueEntry>& p1Heap, std::vector<QueueEntry>& heap, const EntryComp& comp)
+    {
+        _rekeying = false;
+        if (_rekeyAborted)
+        {
+            rekey(comp);
+        }
+        else
+        {
+            // Popped entries that were pushed since startRekey() are not
+            // in the copies.
+            std::map<EntryId, size_t> popped;
+            for (const auto& entry : _poppedDuringRekey)
+            {
+                popped[EntryId(entry)]++;
+            }
+            std::vector<QueueEntry> pushed;
+            for (const auto& entry : _pushedDuringRekey)
+            {
+                auto it = popped.find(EntryId(entry));
+                if (popped.end() != it && it->second > 0)
+                {
+                    it->second--;
+                }
+                else
+                {
+                    pushed.push_back(entry);
+                }
+            }
+
+            comp.computeKeys(pushed);
+            for (const auto& entry : pushed)
+            {
+                std::vector<QueueEntry>& newHeap = entry.getP1() ? p1Heap : heap;
+                newHeap.push_back(entry);
+                std::push_heap(newHeap.begin(), newHeap.end(), comp);
+            }
+            for (const auto& entry : _poppedDuringRekey)
+            {
+                auto it = popped.find(EntryId(entry));
+                if (it->second > 0)
+                {
+                    it->second--;
+                    _removed[it->first]++;
+                    entry.getP1() ? _nbRemovedP1++ : _nbRemoved++;
+                }
+            }
+
+            _p1Heap.swap(p1Heap);
+            _heap.swap(heap);
+            dropRemovedTop(comp);
+        }
+        _pushedDuringRekey.clear();
+        _poppedDuringRekey.clear();
+    }
+
+    // Set P1 to false for all P1 entries and the points they refer to,
+    // and merge them into the other tier.
+    // Return the number of entries that were P1.
+    template <typename EntryComp>
+    size_t setAllP1ToFalse(PointArena& arena, const EntryComp& comp)
+    {
+        const size_t nbP1 = _p1Heap.size() - _nbRemovedP1;
+        if (_p1Heap.empty())
+        {
+            return 0;
+        }
+        _rekeyAborted = _rekeying;
+
+        // The cost part of the keys does not change.
+        for (auto& entry : _p1Heap)
+        {
+            if (arena.isValid(entry.getHandle()))
+            {
+                arena.get(entry.getHandle()).setP1(false);
+            }
+            entry.setP1(false);
+        }
+
+        insertAll(_heap, _p1Heap.begin(), _p1Heap.end(), comp);
+        _p1Heap.clear();
+        _nbRemoved += _nbRemovedP1;
+        _nbRemovedP1 = 0;
+        dropRemovedTop(comp);
+
+        return nbP1;
+    }
+
+    void clear()
+    {
+        _p1Heap.clear();
+        _heap.clear();
+        _rekeyAborted = _rekeying;
+        _removed.clear();
+        _nbRemovedP1 = 0;
+        _nbRemoved = 0;
+    }
+};
+
+
+#endif // __SUBQUEUE_HPP__
@@ -0,0 +1,165 @@
+#include "Threading.hpp"
+
+#include <pthread.h>    // For pthread_setaffinity_np
+#include <sched.h>      // For sched_getaffinity, CPU_SET
+
+
+bool Threading::pinToCore(const int core)
+{
+    cpu_set_t allowed;
+    CPU_ZERO(&allowed);
+    if (0 != sched_getaffinity(0, sizeof(allowed), &allowed))
+    {
+        return false;
+    }
+    const int nbCores = CPU_COUNT(&allowed);
+    if (nbCores <= 0 || core < 0)
+    {
+        return false;
+    }
+
+    // core-th allowed core, modulo their number.
+    int index = core % nbCores;
+    for (int cpu = 0; cpu < CPU_SETSIZE; cpu++)
+    {
+        if (CPU_ISSET(cpu, &allowed) && 0 == index--)
+        {
+            cpu_set_t cpuSet;
+            CPU_ZERO(&cpuSet);
+            CPU_SET(cpu, &cpuSet);
+            return (0 == pthread_setaffinity_np(pthread_self(), sizeof(cpuSet), &cpuSet));
+        }
+    }
+
+    return false;
+}
+
+
+WorkerPool::WorkerPool(const int nbThreads, const bool pinThreads)
+  : _threads(),
+    _pinThreads(pinThreads),
+    _job(),
+    _jobNum(0),
+    _nbRunning(0),
+    _stopping(false),
+    _exception(),
+    _runMutex(),
+    _mutex(),
+    _jobCond(),
+    _doneCond(),
+    _barrierMutex(),
+    _barrierCond(),
+    _nbAtBarrier(0),
+    _barrierNum(0)
+{
+    _threads.reserve(size_t(nbThreads));
+    for (int threadNum = 0; threadNum < nbThreads; threadNum++)
+    {
+        _threads.emplace_back(&WorkerPool::workerLoop, this, threadNum, nbThreads);
+    }
+}
+
+
+WorkerPool::~WorkerPool()
+{
+    {
+        // Wait for the current job.
+        std::lock_guard<std::mutex> runLock(_runMutex);
+        std::lock_guard<std::mutex> lock(_mutex);
+        _stopping = true;
+    }
+    _jobCond.notify_all();
+    for (auto& thread : _threads)
+    {
+        thread.join();
+    }
+}
+
+
+void WorkerPool::workerLoop(const int threadNum, const int nbThreads)
+{
+    // _threads may not be complete yet.
+    Threading::setThreadNum(threadNum, nbThreads);
+    if (_pinThreads)
+    {
+        Threading::pinToCore(threadNum);
+    }
+
+    uint64_t lastJobNum = 0;
+    while (true)
+    {
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            _jobCond.wait(lock, [this, lastJobNum]() { return _stopping || _jobNum != lastJobNum; });
+            if (_stopping)
+            {
+                return;
+            }
+            lastJobNum = _jobNum;
+        }
+
+        // _job is not changed until all threads are done with it.
+        try
+        {
+            _job(threadNum);
+        }
+        catch (...)
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            if (!_exception)
+            {
+                _exception = std::current_exception();
+            }
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            if (0 != --_nbRunning)
+            {
+                continue;
+            }
+        }
+        _doneCond.notify_one();
+    }
+}
+
+
+void WorkerPool::run(const std::function<void(int)>& job)
+{
+    if (_threads.empty())
+    {
+        return;
+    }
+
+    // A single job at a time.
+    std::lock_guard<std::mutex> runLock(_runMutex);
+    std::unique_lock<std::mutex> lock(_mutex);
+    _job = job;
+    _exception = nullptr;
+    _nbRunning = getNbThreads();
+    _jobNum++;
+    _jobCond.notify_all();
+
+    _doneCond.wait(lock, [this]() { return 0 == _nbRunning; });
+    _job = nullptr;
+    if (_exception)
+    {
+        std::rethrow_exception(_exception);
+    }
+}
+
+
+void WorkerPool::barrier()
+{
+    std::unique_lock<std::mutex> lock(_barrierMutex);
+    const uint64_t barrierNum = _barrierNum;
+    if (++_nbAtBarrier == getNbThreads())
+    {
+        _nbAtBarrier = 0;
+        _barrierNum++;
+        lock.unlock();
+        _barrierCond.notify_all();
+        return;
+    }
+    _barrierCond.wait(lock, [this, barrierNum]() { return _barrierNum != barrierNum; });
+}
@@ -0,0 +1,127 @@
+#ifndef __THREADING_HPP__
+#define __THREADING_HPP__
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>      // For uint64_t
+#include <exception>    // For exception_ptr
+#include <functional>
+#include <mutex>
+#include <omp.h>
+#include <thread>
+#include <vector>
+
+// Threads that run the Queue.
+enum class ThreadingBackend
+{
+    OPENMP,         // An OpenMP parallel region, e.g. "#pragma omp parallel"
+    THREAD_POOL     // A WorkerPool of persistent std::thread
+};
+
+
+// Identity of the threads that use the Queue.
+// The thread number is the role of the thread in the Queue: it tells
+// whether the thread is a main thread, which SubQueue it uses, and where
+// its statistics are kept. It is the OpenMP thread number, unless it was
+// set explicitly, by setThreadNum() or by a WorkerPool. So a host
+// application with its own threads gives each of them its number.
+class Threading
+{
+private:
+    inline static thread_local int _threadNum = -1;     // -1: OpenMP thread number
+    inline static thread_local int _nbThreads = 0;      // 0: OpenMP team size
+    inline static std::atomic<int> _maxThreads{0};      // 0: OpenMP maximum
+
+public:
+    static int getThreadNum() { return (_threadNum >= 0) ? _threadNum : omp_get_thread_num(); }
+    // Set the thread number of the current thread, and the number of
+    // threads in its team. threadNum = -1 goes back to OpenMP numbers.
+    static void setThreadNum(const int threadNum, const int nbThreads = 0)
+    {
+        _threadNum = threadNum;
+        _nbThreads = nbThreads;
+    }
+
+    // Number of threads of the team of the current thread.
+    static int getNbThreads() { return (_nbThreads > 0) ? _nbThreads : omp_get_num_threads(); }
+
+    // Maximum number of threads: the Queue sizes its per-thread data with it.
+    // OpenMP maximum number of threads, unless set by setMaxThreads().
+    static int getMaxThreads()
+    {
+        const int maxThreads = _maxThreads.load(std::memory_order_relaxed);
+        return (maxThreads > 0) ? maxThreads : omp_get_max_threads();
+    }
+    // maxThreads = 0 goes back to the OpenMP maximum.
+    static void setMaxThreads(const int maxThreads) { _maxThreads = maxThreads; }
+
+    // Is the current thread one of several threads working together?
+    static bool inParallel() { return (_nbThreads > 1) || omp_in_parallel(); }
+
+    // Pin the current thread to a core. Cores are numbered among the
+    // cores the process may use, modulo their number.
+    // Return false if the thread could not be pinned.
+    static bool pinToCore(const int core);
+};
+
+
+// Pool of persistent threads, an alternative to OpenMP parallel regions.
+// The threads are created once, and wait for jobs: starting a job costs a
+// notification instead of a team start-up. Thread i has thread number i,
+// see Threading, and may be pinned to core i.
+// The Queue sizes its per-thread data with Threading::getMaxThreads():
+// call Threading::setMaxThreads() with the size of the pool before
+// creating the Queue.
+class WorkerPool
+{
+private:
+    std::vector<std::thread> _threads;
+    bool _pinThreads;
+    std::function<void(int)> _job;
+    uint64_t _jobNum;               // Incremented when a job starts
+    int _nbRunning;                 // Threads still running the current job
+    bool _stopping;
+    std::exception_ptr _exception;  // First exception thrown by the current job
+    std::mutex _runMutex;           // A single run() at a time
+    std::mutex _mutex;              // Protects _job to _exception
+    std::condition_variable _jobCond;
+    std::condition_variable _doneCond;
+
+    std::mutex _barrierMutex;
+    std::condition_variable _barrierCond;
+    int _nbAtBarrier;
+    uint64_t _barrierNum;           // Incremented when all threads reach the barrier
+
+    void workerLoop(const int threadNum, const int nbThreads);
+
+public:
+    // Constructor
+    // Start nbThreads threads. If pinThreads is true, thread i is pinned
+    // to core i, see Threading::pinToCore().
+    explicit WorkerPool(const int nbThreads, const bool pinThreads = false);
+
+    // Destructor
+    // Wait for the current job, then stop the threads.
+    virtual ~WorkerPool();
+
+    // The threads cannot be copied.
+    WorkerPool(const WorkerPool&) = delete;
+    WorkerPool& operator=(const WorkerPool&) = delete;
+
+    // Get/Set
+    int getNbThreads() const { return int(_threads.size()); }
+    bool getPinThreads() const { return _pinThreads; }
+
+    // Run job(threadNum) on all threads of the pool, and wait until they
+    // all return. The calling thread only waits. Thread-safe: concurrent
+    // calls run one after the other.
+    // If job throws, the first exception is thrown again here.
+    void run(const std::function<void(int)>& job);
+
+    // Wait until all threads of the pool reach the barrier.
+    // Only called by a job, on all threads.
+    void barrier();
+};
+
+
+#endif // __THREADING_HPP__
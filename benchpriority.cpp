@@ -0,0 +1,104 @@
+#include "Queue.hpp"
+
+#include <random>
+#include <string>
+
+// Benchmark of the comparison functions of the Queue, on a single thread:
+// type-erased LowerPriority against compile-time StaticLowerPriority,
+// comparing points at each step against precomputed keys.
+//
+// Calling argument: Number of points (default 1000000).
+
+
+// Add all points to the queue in a single batch, then pop them all.
+// Print time for adding and popping.
+template <typename Priority>
+void runBenchmark(const std::string& name, const Priority& comp,
+                  const std::vector<QueuePoint>& points)
+{
+    BasicQueue<Priority> queue(comp);
+    std::vector<QueuePointHandle> handles;
+    handles.reserve(points.size());
+    for (const auto& point : points)
+    {
+        handles.push_back(queue.createPoint(point));
+    }
+
+    double startTime = omp_get_wtime();
+    queue.startAdding();
+    for (const auto& handle : handles)
+    {
+        queue.addToQueue(handle);
+    }
+    queue.stopAdding();
+    double addTime = omp_get_wtime() - startTime;
+
+    startTime = omp_get_wtime();
+    QueuePointHandle handle;
+    size_t nbPopped = 0;
+    while (queue.popPoint(handle))
+    {
+        nbPopped++;
+    }
+    double popTime = omp_get_wtime() - startTime;
+
+    std::cout << name << ": add " << 1000 * addTime << " ms, pop " << 1000 * popTime << " ms";
+    std::cout << " (" << nbPopped << " points)" << std::endl;
+}
+
+
+int main(int argc , char **argv)
+{
+    size_t nbPoints = 1000000;
+    if (argc > 1)
+    {
+        nbPoints = std::stoul(argv[1]);
+    }
+
+    // Random points, 10% of P1.
+    std::mt19937 generator(0);
+    std::uniform_real_distribution<double> coord(-10.0, 10.0);
+    std::uniform_real_distribution<double> eval(0.0, 100.0);
+    std::vector<double> coords(2 * nbPoints);  // Coordinates of the points
+    std::vector<QueuePoint> points;
+    points.reserve(nbPoints);
+    for (size_t i = 0; i < nbPoints; i++)
+    {
+        coords[2 * i] = coord(generator);
+        coords[2 * i + 1] = coord(generator);
+        QueuePoint point(&coords[2 * i], 2, eval(generator));
+        point.setP1(0 == i % 10);
+        points.push_back(point);
+    }
+
+    const DirectionPriority direction({ 6, -2 });
+    std::cout << "Direction ordering, " << nbPoints << " points" << std::endl;
+    runBenchmark("LowerPriority, comparison function        ",
+                 LowerPriority(CompFunction([direction](const QueuePoint& p1, const QueuePoint& p2) { return direction.comp(p1, p2); })),
+                 points);
+    runBenchmark("StaticLowerPriority, comparison function  ",
+                 StaticLowerPriority<CompOnly<DirectionPriority>>(direction),
+                 points);
+    runBenchmark("LowerPriority, cost function              ",
+                 LowerPriority(CostFunction([direction](const PointBatch& batch, double* costs) { direction.costs(batch, costs); })),
+                 points);
+    runBenchmark("StaticLowerPriority, cost function        ",
+                 StaticLowerPriority<DirectionPriority>(direction),
+                 points);
+
+    std::cout << "Best eval ordering, " << nbPoints << " points" << std::endl;
+    runBenchmark("LowerPriority, comparison function        ",
+                 LowerPriority(CompFunction(LowerPriority::DefaultComp)),
+                 points);
+    runBenchmark("StaticLowerPriority, comparison function  ",
+                 StaticLowerPriority<CompOnly<DefaultPriority>>(),
+                 points);
+    runBenchmark("LowerPriority, cost function              ",
+                 LowerPriority(),
+                 points);
+    runBenchmark("StaticLowerPriority, cost function        ",
+                 StaticLowerPriority<DefaultPriority>(),
+                 points);
+
+    return 0;
+}
@@ -0,0 +1,232 @@
+#include "Queue.hpp"
+
+#include <algorithm>    // For sort, min
+#include <random>
+#include <string>
+
+// Microbenchmarks of the Queue primitives: addToQueue, stopAdding, sort,
+// rekey, getTopPoint and popPoint, for each backend, for a range of queue sizes
+// and numbers of threads.
+// Operations are timed by blocks of BLOCK_SIZE calls; each block gives
+// one sample of the time per operation. Results are written as CSV on
+// the standard output, one line per operation and configuration, with
+// percentiles over the samples of all threads.
+//
+// Calling arguments (all optional, in this order):
+//  Minimum number of points (default 1000),
+//  maximum number of points (default 10000000), sizes go by powers of 10,
+//  maximum number of threads (default: maximum number of threads),
+//  threads go by powers of 2.
+
+typedef BasicQueue<StaticLowerPriority<DefaultPriority>> BenchQueue;
+
+const size_t BLOCK_SIZE = 64;
+const size_t MAX_NB_TOP_BLOCKS = 1000;  // getTopPoint() does not empty the queue
+const size_t NB_SORTS = 3;
+
+
+// Display one CSV line with the percentiles of the samples, in ns per operation.
+static void report(const std::string& op, const std::string& backendName,
+                   const size_t nbPoints, const int nbThreads,
+                   const std::vector<std::vector<double>>& threadSamples)
+{
+    std::vector<double> samples;
+    for (const auto& oneThreadSamples : threadSamples)
+    {
+        samples.insert(samples.end(), oneThreadSamples.begin(), oneThreadSamples.end());
+    }
+    if (samples.empty())
+    {
+        return;
+    }
+    std::sort(samples.begin(), samples.end());
+
+    double sum = 0.0;
+    for (double sample : samples)
+    {
+        sum += sample;
+    }
+    auto percentile = [&samples](const double p)
+    {
+        size_t rank = size_t(p / 100.0 * double(samples.size() - 1) + 0.5);
+        return samples[std::min(rank, samples.size() - 1)];
+    };
+
+    std::cout << op << "," << backendName << "," << nbPoints << "," << nbThreads << ","
+              << samples.size() << "," << sum / double(samples.size()) << ","
+              << percentile(50) << "," << percentile(90) << "," << percentile(99) << ","
+              << samples.back() << std::endl;
+}
+
+
+static void runBenchmark(const QueueBackend backend, const std::string& backendName,
+                         const std::vector<QueuePoint>& points, const int nbThreads)
+{
+    const size_t nbPoints = points.size();
+    BenchQueue queue((StaticLowerPriority<DefaultPriority>()), backend);
+    // Measure the queue only: points are all different anyway.
+    queue.setCache(nullptr);
+
+    std::vector<QueuePointHandle> handles;
+    handles.reserve(nbPoints);
+    for (const auto& point : points)
+    {
+        handles.push_back(queue.createPoint(point));
+    }
+
+    std::vector<std::vector<double>> addSamples(nbThreads), publishSamples(nbThreads),
+                                     sortSamples(nbThreads), rekeySamples(nbThreads),
+                                     topSamples(nbThreads),
+                                     popSamples(nbThreads);
+
+    #pragma omp parallel num_threads(nbThreads) default(shared)
+    {
+        const int threadNum = omp_get_thread_num();
+        const size_t first = nbPoints * threadNum / nbThreads;
+        const size_t last = nbPoints * (threadNum + 1) / nbThreads;
+
+        // Add this thread's share of the points, by blocks. addToQueue()
+        // only stages the points; stopAdding() puts them in the heaps.
+        for (size_t start = first; start < last; start += BLOCK_SIZE)
+        {
+            const size_t end = std::min(start + BLOCK_SIZE, last);
+            queue.startAdding();
+            double startTime = omp_get_wtime();
+            for (size_t i = start; i < end; i++)
+            {
+                queue.addToQueue(handles[i]);
+            }
+            double addTime = omp_get_wtime();
+            queue.stopAdding();
+            double publishTime = omp_get_wtime();
+            addSamples[threadNum].push_back(1e9 * (addTime - startTime) / double(end - start));
+            publishSamples[threadNum].push_back(1e9 * (publishTime - addTime) / double(end - start));
+        }
+        #pragma omp barrier
+
+        for (size_t block = 0; block < MAX_NB_TOP_BLOCKS && block * BLOCK_SIZE < last - first; block++)
+        {
+            double startTime = omp_get_wtime();
+            for (size_t i = 0; i < BLOCK_SIZE; i++)
+            {
+                queue.getTopPoint();
+            }
+            topSamples[threadNum].push_back(1e9 * (omp_get_wtime() - startTime) / double(BLOCK_SIZE));
+        }
+        #pragma omp barrier
+
+        // sort() locks the whole queue: a single thread at a time.
+        // One sample per call, in ns per point in the queue.
+        #pragma omp single
+        {
+            for (size_t i = 0; i < NB_SORTS; i++)
+            {
+                double startTime = omp_get_wtime();
+                queue.sort();
+                sortSamples[threadNum].push_back(1e9 * (omp_get_wtime() - startTime) / double(nbPoints));
+            }
+        }   // Implicit barrier
+
+        // rekey() only locks the queue to swap the reordered heaps in.
+        #pragma omp single
+        {
+            for (size_t i = 0; i < NB_SORTS; i++)
+            {
+                double startTime = omp_get_wtime();
+                queue.rekey(queue.getComp());
+                rekeySamples[threadNum].push_back(1e9 * (omp_get_wtime() - startTime) / double(nbPoints));
+            }
+        }   // Implicit barrier
+
+        // Pop until the queue is empty.
+        QueuePointHandle handle;
+        bool popped = true;
+        while (popped)
+        {
+            size_t nbPopped = 0;
+            double startTime = omp_get_wtime();
+            while (nbPopped < BLOCK_SIZE && (popped = queue.popPoint(handle)))
+            {
+                nbPopped++;
+            }
+            if (nbPopped > 0)
+            {
+                popSamples[threadNum].push_back(1e9 * (omp_get_wtime() - startTime) / double(nbPopped));
+            }
+        }
+    }   // End parallel region
+
+    report("addToQueue", backendName, nbPoints, nbThreads, addSamples);
+    report("stopAdding", backendName, nbPoints, nbThreads, publishSamples);
+    report("sort", backendName, nbPoints, nbThreads, sortSamples);
+    report("rekey", backendName, nbPoints, nbThreads, rekeySamples);
+    report("getTopPoint", backendName, nbPoints, nbThreads, topSamples);
+    report("popPoint", backendName, nbPoints, nbThreads, popSamples);
+}
+
+
+int main(int argc , char **argv)
+{
+    size_t minNbPoints = 1000;
+    size_t maxNbPoints = 10000000;
+    int maxNbThreads = omp_get_max_threads();
+    if (argc > 1)
+    {
+        minNbPoints = std::max(std::stoul(argv[1]), 1ul);
+    }
+    if (argc > 2)
+    {
+        maxNbPoints = std::stoul(argv[2]);
+    }
+    if (argc > 3 && std::atoi(argv[3]) > 0)
+    {
+        maxNbThreads = std::atoi(argv[3]);
+    }
+
+    // The queue sizes its per-thread data with the maximum number of threads.
+    omp_set_num_threads(maxNbThreads);
+
+    std::vector<int> nbThreadsList;
+    for (int nbThreads = 1; nbThreads < maxNbThreads; nbThreads *= 2)
+    {
+        nbThreadsList.push_back(nbThreads);
+    }
+    nbThreadsList.push_back(maxNbThreads);
+
+    const std::vector<std::pair<QueueBackend, std::string>> backends =
+    {
+        { QueueBackend::LOCKED, "locked" },
+        { QueueBackend::MULTIQUEUE, "multiqueue" },
+        { QueueBackend::PER_MAIN_THREAD, "permainthread" }
+    };
+
+    std::cout << "op,backend,points,threads,samples,mean_ns,p50_ns,p90_ns,p99_ns,max_ns" << std::endl;
+    for (size_t nbPoints = minNbPoints; nbPoints <= maxNbPoints; nbPoints *= 10)
+    {
+        // Random points, 10% of P1, the same for all configurations.
+        std::mt19937 generator(0);
+        std::uniform_real_distribution<double> coord(-10.0, 10.0);
+        std::uniform_real_distribution<double> eval(0.0, 100.0);
+        std::vector<double> coords(2 * nbPoints);  // Coordinates of the points
+        std::vector<QueuePoint> points;
+        points.reserve(nbPoints);
+        for (size_t i = 0; i < nbPoints; i++)
+        {
+            coords[2 * i] = coord(generator);
+            coords[2 * i + 1] = coord(generator);
+            QueuePoint point(&coords[2 * i], 2, eval(generator));
+            point.setP1(0 == i % 10);
+            points.push_back(point);
+        }
+
+        for (const auto& backend : backends)
+        {
+            for (int nbThreads : nbThreadsList)
+            {
+                runBenchmark(backend.first, backend.second, points, nbThreads);
+            }
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,428 @@
+#include "Queue.hpp"
+
+#include <algorithm>    // For max
+#include <chrono>
+#include <cmath>
+#include <memory>
+#include <random>
+#include <string>
+#include <thread>
+
+// Synthetic workload for the Queue, at a larger scale than main.cpp.
+// Each main thread generates batches of random points, adds them to the
+// queue, and waits until the whole batch is evaluated before generating
+// the next one, as an optimization algorithm does. Other threads evaluate
+// points. Evaluations take a random time, with a chosen distribution.
+//
+// Calling arguments (all optional, in this order):
+//  Number of threads (default: maximum number of threads),
+//  number of main threads (default 1),
+//  points per batch (default 1000),
+//  batches per main thread (default 10),
+//  fraction of P1 points (default 0.1),
+//  latency distribution: "constant", "lognormal" or "heavytailed" (default constant),
+//  mean evaluation latency in microseconds (default 100),
+//  queue backend: "locked", "multiqueue" or "permainthread" (default locked),
+//  points in flight per thread, for asynchronous evaluation (default 0:
+//  synchronous evaluation),
+//  dimension of the points (default 2),
+//  threads: "openmp" for an OpenMP parallel region, "pool" for a WorkerPool
+//  of std::thread, or "pinnedpool" for a WorkerPool with threads pinned to
+//  cores (default openmp).
+//
+// Reports evals/s, worker utilization, time to first evaluation and makespan.
+// Fails if a point is left without evaluation.
+
+
+enum class LatencyDistribution
+{
+    CONSTANT,
+    LOGNORMAL,      // sigma = 1
+    HEAVY_TAILED    // Pareto, alpha = 1.5: infinite variance
+};
+
+
+// Evaluates a quadratic function, after waiting for a random latency
+// per point. The latency is a wait, not a computation, as for a blackbox
+// running outside of the process.
+// For asynchronous evaluation, the latency is simulated by a
+// SyntheticAsyncEvaluator instead.
+class SyntheticEvaluator : public Evaluator
+{
+private:
+    LatencyDistribution _distribution;
+    double _meanLatency;                    // In seconds
+    bool _wait;                             // Wait for the latency in eval()
+    double _startTime;
+    mutable std::atomic<double> _firstEvalTime;    // Time of the first evaluation done, 0 if none
+
+public:
+    // Constructor
+    explicit SyntheticEvaluator(const LatencyDistribution distribution,
+                                const double meanLatency,
+                                const bool wait,
+                                const double startTime)
+      : _distribution(distribution),
+        _meanLatency(meanLatency),
+        _wait(wait),
+        _startTime(startTime),
+        _firstEvalTime(0.0)
+    {
+    }
+
+    double drawLatency() const
+    {
+        static thread_local std::mt19937 generator(std::random_device{}() + Threading::getThreadNum());
+        if (LatencyDistribution::LOGNORMAL == _distribution)
+        {
+            const double sigma = 1.0;
+            std::lognormal_distribution<double> latency(std::log(_meanLatency) - sigma * sigma / 2.0, sigma);
+            return latency(generator);
+        }
+        if (LatencyDistribution::HEAVY_TAILED == _distribution)
+        {
+            // Pareto by inversion, with minimum chosen to get the mean.
+            const double alpha = 1.5;
+            const double minLatency = _meanLatency * (alpha - 1.0) / alpha;
+            std::uniform_real_distribution<double> uniform(0.0, 1.0);
+            return minLatency / std::pow(1.0 - uniform(generator), 1.0 / alpha);
+        }
+        return _meanLatency;
+    }
+
+    void eval(const PointBatch& batch, double* evals) const override
+    {
+        if (_wait)
+        {
+            double latency = 0.0;
+            for (size_t i = 0; i < batch.size(); i++)
+            {
+                latency += drawLatency();
+            }
+            std::this_thread::sleep_for(std::chrono::duration<double>(latency));
+        }
+
+        // Shifted so that evals are never 0, which means "not evaluated".
+        const size_t n = batch.size();
+        const size_t dimension = batch.getDimension();
+        for (size_t i = 0; i < n; i++)
+        {
+            const double* x = batch.getCoords(i);
+            evals[i] = 1.0 + dot(x, x, dimension);
+        }
+
+        if (_wait)
+        {
+            setEvalDone();
+        }
+    }
+
+    // Record the time of the first evaluation done.
+    void setEvalDone() const
+    {
+        double noEval = 0.0;
+        _firstEvalTime.compare_exchange_strong(noEval, omp_get_wtime());
+    }
+
+    void setStartTime(const double startTime) { _startTime = startTime; }
+
+    // Time from start time to the first evaluation, 0 if none.
+    double getTimeToFirstEval() const
+    {
+        double firstEvalTime = _firstEvalTime;
+        return (firstEvalTime > 0.0) ? firstEvalTime - _startTime : 0.0;
+    }
+};
+
+
+// Asynchronous evaluation: values from a SyntheticEvaluator, returned
+// after a latency drawn from its distribution.
+class SyntheticAsyncEvaluator : public SimulatedAsyncEvaluator
+{
+private:
+    std::shared_ptr<SyntheticEvaluator> _evaluator;
+
+public:
+    // Constructor
+    explicit SyntheticAsyncEvaluator(const std::shared_ptr<SyntheticEvaluator>& evaluator)
+      : SimulatedAsyncEvaluator(evaluator, LatencyFunction([evaluator]() { return evaluator->drawLatency(); })),
+        _evaluator(evaluator)
+    {
+    }
+
+    size_t poll(std::vector<AsyncResult>& results, const double timeout) override
+    {
+        size_t nbResults = SimulatedAsyncEvaluator::poll(results, timeout);
+        if (nbResults > 0)
+        {
+            _evaluator->setEvalDone();
+        }
+        return nbResults;
+    }
+};
+
+
+int main(int argc , char **argv)
+{
+    int nbThreads = omp_get_max_threads();
+    int nbMainThreads = 1;
+    size_t nbPointsPerBatch = 1000;
+    size_t nbBatches = 10;
+    double p1Fraction = 0.1;
+    LatencyDistribution distribution = LatencyDistribution::CONSTANT;
+    double meanLatency = 100e-6;
+    QueueBackend backend = QueueBackend::LOCKED;
+    std::string distributionStr("constant");
+    std::string backendStr("locked");
+    size_t maxInFlight = 0;
+    size_t dimension = 2;
+    ThreadingBackend threading = ThreadingBackend::OPENMP;
+    bool pinThreads = false;
+    std::string threadingStr("openmp");
+
+    if (argc > 1 && 0 != std::atoi(argv[1]))
+    {
+        nbThreads = std::atoi(argv[1]);
+    }
+    if (argc > 2 && 0 != std::atoi(argv[2]))
+    {
+        nbMainThreads = std::atoi(argv[2]);
+    }
+    if (argc > 3)
+    {
+        nbPointsPerBatch = std::stoul(argv[3]);
+    }
+    if (argc > 4)
+    {
+        nbBatches = std::stoul(argv[4]);
+    }
+    if (argc > 5)
+    {
+        p1Fraction = std::atof(argv[5]);
+    }
+    if (argc > 6)
+    {
+        distributionStr = argv[6];
+        if ("lognormal" == distributionStr)
+        {
+            distribution = LatencyDistribution::LOGNORMAL;
+        }
+        else if ("heavytailed" == distributionStr)
+        {
+            distribution = LatencyDistribution::HEAVY_TAILED;
+        }
+        else if ("constant" != distributionStr)
+        {
+            std::cerr << "Error: unknown latency distribution " << distributionStr << ". Use constant, lognormal or heavytailed." << std::endl;
+            return 1;
+        }
+    }
+    if (argc > 7)
+    {
+        meanLatency = std::atof(argv[7]) * 1e-6;
+    }
+    if (argc > 8)
+    {
+        backendStr = argv[8];
+        if ("multiqueue" == backendStr)
+        {
+            backend = QueueBackend::MULTIQUEUE;
+        }
+        else if ("permainthread" == backendStr)
+        {
+            backend = QueueBackend::PER_MAIN_THREAD;
+        }
+        else if ("locked" != backendStr)
+        {
+            std::cerr << "Error: unknown queue backend " << backendStr << ". Use locked, multiqueue or permainthread." << std::endl;
+            return 1;
+        }
+    }
+    if (argc > 9)
+    {
+        maxInFlight = std::stoul(argv[9]);
+    }
+    if (argc > 10 && 0 != std::atoi(argv[10]))
+    {
+        dimension = std::stoul(argv[10]);
+    }
+    if (argc > 11)
+    {
+        threadingStr = argv[11];
+        if ("pool" == threadingStr || "pinnedpool" == threadingStr)
+        {
+            threading = ThreadingBackend::THREAD_POOL;
+            pinThreads = ("pinnedpool" == threadingStr);
+        }
+        else if ("openmp" != threadingStr)
+        {
+            std::cerr << "Error: unknown threads " << threadingStr << ". Use openmp, pool or pinnedpool." << std::endl;
+            return 1;
+        }
+    }
+    if (nbThreads < nbMainThreads)
+    {
+        std::cerr << "Error: number of main threads (" << nbMainThreads << ") should be less or equal to number of threads (" << nbThreads << ")." << std::endl;
+        return 1;
+    }
+
+    // The queue sizes its per-thread data with the maximum number of threads.
+    // The pool is started before the clock, as a host application would.
+    omp_set_num_threads(nbThreads);
+    Threading::setMaxThreads(nbThreads);
+    std::unique_ptr<WorkerPool> pool;
+    if (ThreadingBackend::THREAD_POOL == threading)
+    {
+        pool.reset(new WorkerPool(nbThreads, pinThreads));
+    }
+    BasicQueue<StaticLowerPriority<DefaultPriority>> queue((StaticLowerPriority<DefaultPriority>()), backend, 0, dimension);
+    auto evaluator = std::make_shared<SyntheticEvaluator>(distribution, meanLatency, 0 == maxInFlight, omp_get_wtime());
+    queue.setEvaluator(evaluator);
+    if (maxInFlight > 0)
+    {
+        queue.setAsyncEvaluator(std::make_shared<SyntheticAsyncEvaluator>(evaluator), maxInFlight);
+    }
+    queue.setStatsEnabled(true);
+    // Main threads are the first threads of the parallel region, or of the pool.
+    // Thread 0 is already a main thread.
+    for (int threadNum = 1; threadNum < nbMainThreads; threadNum++)
+    {
+        queue.addMainThread(threadNum);
+    }
+
+    // The queue logs information for each point: keep warnings only, so
+    // that the benchmark measures the queue and not the log.
+    Logger::setLevel(LogLevel::WARNING);
+
+    // Starting the threads is part of the makespan.
+    const double startTime = omp_get_wtime();
+    double makespan = 0.0;
+    evaluator->setStartTime(startTime);
+    queue.clearStats();
+    // Points created by each main thread, checked once the threads are done.
+    std::vector<std::vector<QueuePointHandle>> createdHandles(nbMainThreads);
+    auto work = [&](const int threadNum)
+    {
+        if (queue.isMainThread(threadNum))
+        {
+            std::mt19937 generator(threadNum);
+            std::uniform_real_distribution<double> coord(-10.0, 10.0);
+            std::uniform_real_distribution<double> uniform(0.0, 1.0);
+            std::vector<double> coords(dimension);
+            std::vector<QueuePointHandle> handles;
+            handles.reserve(nbPointsPerBatch);
+            for (size_t batch = 0; batch < nbBatches; batch++)
+            {
+                handles.clear();
+                for (size_t i = 0; i < nbPointsPerBatch; i++)
+                {
+                    for (auto& c : coords)
+                    {
+                        c = coord(generator);
+                    }
+                    QueuePoint point(coords.data(), dimension, 50.0 * dimension);
+                    point.setP1(uniform(generator) < p1Fraction);
+                    handles.push_back(queue.createPoint(point));
+                }
+
+                queue.startAdding();
+                for (const auto& handle : handles)
+                {
+                    queue.addToQueue(handle);
+                }
+                queue.stopAdding();
+                createdHandles[threadNum].insert(createdHandles[threadNum].end(), handles.begin(), handles.end());
+
+                // Wait until the batch is evaluated. Main threads help
+                // with P1 points: run() returns when there are none left.
+                // isEvaluated() synchronizes with the thread that set it.
+                size_t nbEvaluated = 0;
+                while (nbEvaluated < handles.size())
+                {
+                    if (queue.getPoint(handles[nbEvaluated]).isEvaluated())
+                    {
+                        nbEvaluated++;
+                        continue;
+                    }
+                    queue.run();
+                    std::this_thread::sleep_for(std::chrono::microseconds(20));
+                }
+                // Points are not released: a worker may still be using
+                // a point just after setting its evaluation.
+            }
+
+            #pragma omp critical(benchMakespan)
+            {
+                makespan = std::max(makespan, omp_get_wtime() - startTime);
+            }
+            // Give up the main role, and help the other main threads.
+            queue.stop();
+        }
+        // Evaluate until all main threads are done.
+        queue.run();
+    };
+    if (ThreadingBackend::THREAD_POOL == threading)
+    {
+        pool->run(work);
+    }
+    else
+    {
+        #pragma omp parallel num_threads(nbThreads) default(shared)
+        work(omp_get_thread_num());
+    }
+
+    // All points must be evaluated. The threads are joined: their
+    // evaluations are visible.
+    size_t nbCreated = 0;
+    size_t nbUnevaluated = 0;
+    for (const auto& handles : createdHandles)
+    {
+        nbCreated += handles.size();
+        for (const auto& handle : handles)
+        {
+            if (!queue.getPoint(handle).isEvaluated())
+            {
+                nbUnevaluated++;
+            }
+        }
+    }
+
+    // Utilization of the threads that were not main threads: fraction of
+    // the makespan spent in the evaluator.
+    std::vector<ThreadStats> threadStats = queue.getStats().getSnapshot();
+    ThreadStats total = queue.getStats().getTotal();
+    double workerEvalTime = 0.0;
+    int nbWorkers = 0;
+    for (int threadNum = 0; threadNum < nbThreads && threadNum < int(threadStats.size()); threadNum++)
+    {
+        if (threadNum >= nbMainThreads)
+        {
+            workerEvalTime += threadStats[threadNum].getEvalTime();
+            nbWorkers++;
+        }
+    }
+
+    std::cout << "threads: " << nbThreads << std::endl;
+    std::cout << "main_threads: " << nbMainThreads << std::endl;
+    std::cout << "backend: " << backendStr << std::endl;
+    std::cout << "threading: " << threadingStr << std::endl;
+    std::cout << "points_per_batch: " << nbPointsPerBatch << std::endl;
+    std::cout << "batches: " << nbBatches << std::endl;
+    std::cout << "dimension: " << dimension << std::endl;
+    std::cout << "p1_fraction: " << p1Fraction << std::endl;
+    std::cout << "latency: " << distributionStr << " " << meanLatency * 1e6 << "us" << std::endl;
+    std::cout << "in_flight_per_thread: " << maxInFlight << std::endl;
+    std::cout << "evals: " << total.getNbEvals() << std::endl;
+    std::cout << "evals_per_s: " << (makespan > 0.0 ? double(total.getNbEvals()) / makespan : 0.0) << std::endl;
+    std::cout << "worker_utilization: " << (nbWorkers > 0 && makespan > 0.0 ? workerEvalTime / (nbWorkers * makespan) : 0.0) << std::endl;
+    std::cout << "time_to_first_eval_ms: " << 1000 * evaluator->getTimeToFirstEval() << std::endl;
+    std::cout << "makespan_ms: " << 1000 * makespan << std::endl;
+
+    if (0 != nbUnevaluated)
+    {
+        std::cerr << "Error: " << nbUnevaluated << " of " << nbCreated << " points not evaluated." << std::endl;
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,70 @@
+#include <chrono>
+#include <cstdint>      // For uint32_t
+#include <cstdio>
+#include <cstdlib>      // For atof
+#include <string>
+#include <thread>       // For sleep_for
+#include <vector>
+
+// Worker process for ProcessEvaluator: reads batches of points on its
+// standard input and writes their evaluations on its standard output,
+// until its standard input is closed. See ProcessEvaluator.hpp for the
+// protocol.
+//
+// Calling arguments (all optional): function, "quadratic" (default) or
+// "rosenbrock"; latency per point, in microseconds (default 0).
+int main(int argc , char **argv)
+{
+    bool rosenbrock = false;
+    double latency = 0.0;
+    if (argc > 1)
+    {
+        rosenbrock = ("rosenbrock" == std::string(argv[1]));
+    }
+    if (argc > 2)
+    {
+        latency = std::atof(argv[2]) * 1e-6;
+    }
+
+    std::vector<double> coords;
+    std::vector<double> evals;
+    uint32_t header[2];     // Number of points, dimension
+    while (1 == std::fread(header, sizeof(header), 1, stdin))
+    {
+        const size_t nbPoints = header[0];
+        const size_t dimension = header[1];
+        coords.resize(nbPoints * dimension);
+        evals.resize(nbPoints);
+        if (coords.size() != std::fread(coords.data(), sizeof(double), coords.size(), stdin))
+        {
+            return 1;
+        }
+
+        if (latency > 0.0)
+        {
+            std::this_thread::sleep_for(std::chrono::duration<double>(latency * nbPoints));
+        }
+        for (size_t i = 0; i < nbPoints; i++)
+        {
+            const double* x = coords.data() + i * dimension;
+            double sum = 0.0;
+            for (size_t j = 0; j < dimension; j++)
+            {
+                if (!rosenbrock)
+                {
+                    sum += x[j] * x[j];
+                }
+                else if (j + 1 < dimension)
+                {
+                    sum += (1.0 - x[j]) * (1.0 - x[j]) + 100.0 * (x[j + 1] - x[j] * x[j]) * (x[j + 1] - x[j] * x[j]);
+                }
+            }
+            evals[i] = sum;
+        }
+
+        std::fwrite(evals.data(), sizeof(double), evals.size(), stdout);
+        std::fflush(stdout);
+    }
+
+    return 0;
+}
@@ -1,56 +1,35 @@
 
+#include "ProcessEvaluator.hpp"
 #include "Queue.hpp"
 
-// Static class...
-class OrderByDirection
-{
-private:
-    static double _dirX;
-    static double _dirY;
-
-public:
-    // Get/Set
-    static void setDirX(double dirX) { _dirX = dirX; }
-    static void setDirY(double dirY) { _dirY = dirY; }
-    static double getDirX() { return _dirX; }
-    static double getDirY() { return _dirY; }
-
-    // Simple implementation of sorting points according
-    // to a direction. Points that match this direction
-    // the most have a higher priority.
-    static bool comp(QueuePointPtr& p1, QueuePointPtr& p2)
-    {
-        bool lowerPriority = false;
-
-        double d1x = (p1->getX() - _dirX);
-        double d1y = (p1->getY() - _dirY);
-        double val1 = (d1x * d1x) + (d1y * d1y);    // square norm
-
-        double d2x = (p2->getX() - _dirX);
-        double d2y = (p2->getY() - _dirY);
-        double val2 = (d2x * d2x) + (d2y * d2y);
-
-        // The point farthest from _dir gets lower priority.
-        if (val1 > val2)
-        {
-            lowerPriority = true;
-        }
-
-        return lowerPriority;
-    }
-};
-
+#include <sstream>
+#include <stdexcept>    // For runtime_error
+#include <string>
 
-// Init statics
-double OrderByDirection::_dirX = 0.0;
-double OrderByDirection::_dirY = 0.0;
+// Queue ordered by direction: points that match the direction the most
+// have a higher priority. The policy is known at compile time, so that
+// computing the keys is inlined.
+typedef BasicQueue<StaticLowerPriority<DirectionPriority>> DirectionQueue;
 
 
-// Calling argument: Number of threads to use.
+// Calling arguments: Number of threads to use, number of main threads,
+// queue backend ("locked", "multiqueue" or "permainthread"),
+// options, separated by commas: "stats" to display the queue statistics
+// at the end, "journal=<file>" to keep the evaluations in a journal file
+// and reload them when the program is run again, "inflight=<n>" to keep
+// n points in flight per thread with the worker processes, "timeout=<s>"
+// to restart the worker processes that do not reply within s seconds,
+// command of worker processes to evaluate the points, e.g. "./evalworker"
+// followed by its arguments (default: random evaluations).
 int main(int argc , char **argv)
 {
     int nbThreads = omp_get_max_threads();
     int nbMainThreads = nbThreads / 3 + 1;
+    QueueBackend backend = QueueBackend::LOCKED;
+    bool displayStats = false;
+    std::string journalFile;
+    size_t maxInFlight = 0;
+    double replyTimeout = 0.0;
     if (argc > 1)
     {
         nbThreads = std::atoi(argv[1]);
@@ -67,6 +46,47 @@ int main(int argc , char **argv)
                 nbMainThreads = 1;
             }
         }
+        if (argc > 3)
+        {
+            std::string backendStr(argv[3]);
+            if ("multiqueue" == backendStr)
+            {
+                backend = QueueBackend::MULTIQUEUE;
+            }
+            else if ("permainthread" == backendStr)
+            {
+                backend = QueueBackend::PER_MAIN_THREAD;
+            }
+            else if ("locked" != backendStr)
+            {
+                std::cerr << "Error: unknown queue backend " << backendStr << ". Use locked, multiqueue or permainthread." << std::endl;
+                return 1;
+            }
+        }
+        if (argc > 4)
+        {
+            std::stringstream options(argv[4]);
+            std::string option;
+            while (std::getline(options, option, ','))
+            {
+                if ("stats" == option)
+                {
+                    displayStats = true;
+                }
+                else if (0 == option.compare(0, 8, "journal="))
+                {
+                    journalFile = option.substr(8);
+                }
+                else if (0 == option.compare(0, 9, "inflight="))
+                {
+                    maxInFlight = std::atoi(option.substr(9).c_str());
+                }
+                else if (0 == option.compare(0, 8, "timeout="))
+                {
+                    replyTimeout = std::atof(option.substr(8).c_str());
+                }
+            }
+        }
     }
     if (nbThreads < nbMainThreads)
     {
@@ -78,77 +98,106 @@ int main(int argc , char **argv)
         std::cout << "Working with " << nbMainThreads << " main thread" << (nbMainThreads > 1 ? "s" : "") << " on a total of " << nbThreads << " thread" << (nbThreads > 1 ? "s" : "") << "." << std::endl;
     }
 
+    // The queue sizes its per-thread data, e.g. thread roles, with the
+    // maximum number of threads.
+    omp_set_num_threads(nbThreads);
+
     // Create queue for all threads
-    LowerPriority orderByDirection(OrderByDirection::comp);
-    OrderByDirection::setDirX(6);
-    OrderByDirection::setDirY(-2);
+    StaticLowerPriority<DirectionPriority> orderByDirection(DirectionPriority({ 6, -2 }));
     // June 2020: Queue is now a vector, instead of using a priority_queue.
-    // Sorting is done when stopAdding() is called.
-    Queue queue(orderByDirection);
+    // The vector is kept as a binary heap: each point is inserted in O(log n)
+    // when it is added, no full sort is done when stopAdding() is called.
+    DirectionQueue queue(orderByDirection, backend);
+    queue.setStatsEnabled(displayStats);
+    if (!journalFile.empty())
+    {
+        size_t nbLoaded = queue.setJournal(std::make_shared<EvalJournal>(journalFile, queue.getDimension()));
+        std::cout << "Loaded " << nbLoaded << " evaluations from journal " << journalFile << "." << std::endl;
+    }
+    if (argc > 5)
+    {
+        std::vector<std::string> workerCommand(argv + 5, argv + argc);
+        std::shared_ptr<ProcessEvaluator> processEvaluator;
+        try
+        {
+            processEvaluator = std::make_shared<ProcessEvaluator>(workerCommand, nbThreads, replyTimeout);
+        }
+        catch (const std::runtime_error& e)
+        {
+            std::cerr << "Error: " << e.what() << std::endl;
+            return 1;
+        }
+        queue.setEvaluator(processEvaluator);
+        if (maxInFlight > 0)
+        {
+            queue.setAsyncEvaluator(processEvaluator, maxInFlight);
+        }
+    }
     queue.start();
     std::cout << "Start main" << std::endl;
 
     // Init points here... for testing purposes.
-    auto pP1 = QueuePointPtr(new QueuePoint(5, -2, 59)); // x, y, eval
-    auto pP2 = QueuePointPtr(new QueuePoint(4, -2, 58));
-    auto pP3 = QueuePointPtr(new QueuePoint(5, -1, 40));
-    auto pP4 = QueuePointPtr(new QueuePoint(4, -1, 76));
-    auto pP5 = QueuePointPtr(new QueuePoint(5, -3, 9));
-    auto pP6 = QueuePointPtr(new QueuePoint(4, -3, 38));
-    auto pP7 = QueuePointPtr(new QueuePoint(6, -2, 23));
-    auto pP8 = QueuePointPtr(new QueuePoint(6, -2, 31));
-    auto pP9 = QueuePointPtr(new QueuePoint(6, -1, 57));
-    auto pP10 = QueuePointPtr(new QueuePoint(6, -1, 11));
-    auto pP11 = QueuePointPtr(new QueuePoint(6, -3, 85));
-    auto pP12 = QueuePointPtr(new QueuePoint(6, -3, 22));
-    auto pP13 = QueuePointPtr(new QueuePoint(7, -2, 49));
-    auto pP14 = QueuePointPtr(new QueuePoint(7, -1, 66));
-    auto pP15 = QueuePointPtr(new QueuePoint(7, -3, 91));
-    auto pP16 = QueuePointPtr(new QueuePoint(4, -4, 28));
-    auto pP17 = QueuePointPtr(new QueuePoint(6, -4, 13));
-    auto pP18 = QueuePointPtr(new QueuePoint(6, -5, 21));
-    auto pP19 = QueuePointPtr(new QueuePoint(6, -5, 47));
-    auto pP20 = QueuePointPtr(new QueuePoint(7, -5, 1));
-    auto pP21 = QueuePointPtr(new QueuePoint(7, -5, 75));
-    auto pP22 = QueuePointPtr(new QueuePoint(8, -3, 12));
-    auto pP23 = QueuePointPtr(new QueuePoint(8, -2, 48));
-    auto pP24 = QueuePointPtr(new QueuePoint(8, -1, 30));
-    auto pP25 = QueuePointPtr(new QueuePoint(7.1, -3.1, 48));
-    auto pP26 = QueuePointPtr(new QueuePoint(4.1, -4.1, 43));
-    auto pP27 = QueuePointPtr(new QueuePoint(6.1, -4.1, 60));
-    auto pP28 = QueuePointPtr(new QueuePoint(6.1, -5.1, 63));
-    auto pP29 = QueuePointPtr(new QueuePoint(6.1, -5.2, 24));
-    auto pP30 = QueuePointPtr(new QueuePoint(7.1, -5.2, 49));
-    auto pP31 = QueuePointPtr(new QueuePoint(7.1, -5.3, 63));
-    auto pP32 = QueuePointPtr(new QueuePoint(8.1, -3.3, 25));
-    auto pP33 = QueuePointPtr(new QueuePoint(8.1, -2.4, 53));
-    auto pP34 = QueuePointPtr(new QueuePoint(8.1, -1.4, 17));
-    auto pP35 = QueuePointPtr(new QueuePoint(7.1, -3.5, 5));
-    auto pP36 = QueuePointPtr(new QueuePoint(4.1, -4.5, 53));
-    auto pP37 = QueuePointPtr(new QueuePoint(6.1, -4.6, 47));
-    auto pP38 = QueuePointPtr(new QueuePoint(6.1, -5.6, 59));
-    auto pP39 = QueuePointPtr(new QueuePoint(6.1, -5.7, 47));
-    auto pP40 = QueuePointPtr(new QueuePoint(7.1, -5.7, 95));
-    auto pP41 = QueuePointPtr(new QueuePoint(7.1, -5.8, 93));
-    auto pP42 = QueuePointPtr(new QueuePoint(8.1, -3.8, 85));
-    auto pP43 = QueuePointPtr(new QueuePoint(8.1, -2.9, 59));
-    auto pP44 = QueuePointPtr(new QueuePoint(8.1, -1.11, 5));
-    auto pP45 = QueuePointPtr(new QueuePoint(7.1, -3.11, 46));
-    auto pP46 = QueuePointPtr(new QueuePoint(4.1, -4.11, 83));
-    auto pP47 = QueuePointPtr(new QueuePoint(6.1, -4.8, 54));
-    auto pP48 = QueuePointPtr(new QueuePoint(6.1, -5.9, 38));
-    auto pP49 = QueuePointPtr(new QueuePoint(6.1, -5.11, 18));
+    // Points are stored in the queue's arena; we keep handles to them.
+    auto pP1 = queue.createPoint({ 5, -2 }, 59); // x, y, eval
+    auto pP2 = queue.createPoint({ 4, -2 }, 58);
+    auto pP3 = queue.createPoint({ 5, -1 }, 40);
+    auto pP4 = queue.createPoint({ 4, -1 }, 76);
+    auto pP5 = queue.createPoint({ 5, -3 }, 9);
+    auto pP6 = queue.createPoint({ 4, -3 }, 38);
+    auto pP7 = queue.createPoint({ 6, -2 }, 23);
+    auto pP8 = queue.createPoint({ 6, -2 }, 31);
+    auto pP9 = queue.createPoint({ 6, -1 }, 57);
+    auto pP10 = queue.createPoint({ 6, -1 }, 11);
+    auto pP11 = queue.createPoint({ 6, -3 }, 85);
+    auto pP12 = queue.createPoint({ 6, -3 }, 22);
+    auto pP13 = queue.createPoint({ 7, -2 }, 49);
+    auto pP14 = queue.createPoint({ 7, -1 }, 66);
+    auto pP15 = queue.createPoint({ 7, -3 }, 91);
+    auto pP16 = queue.createPoint({ 4, -4 }, 28);
+    auto pP17 = queue.createPoint({ 6, -4 }, 13);
+    auto pP18 = queue.createPoint({ 6, -5 }, 21);
+    auto pP19 = queue.createPoint({ 6, -5 }, 47);
+    auto pP20 = queue.createPoint({ 7, -5 }, 1);
+    auto pP21 = queue.createPoint({ 7, -5 }, 75);
+    auto pP22 = queue.createPoint({ 8, -3 }, 12);
+    auto pP23 = queue.createPoint({ 8, -2 }, 48);
+    auto pP24 = queue.createPoint({ 8, -1 }, 30);
+    auto pP25 = queue.createPoint({ 7.1, -3.1 }, 48);
+    auto pP26 = queue.createPoint({ 4.1, -4.1 }, 43);
+    auto pP27 = queue.createPoint({ 6.1, -4.1 }, 60);
+    auto pP28 = queue.createPoint({ 6.1, -5.1 }, 63);
+    auto pP29 = queue.createPoint({ 6.1, -5.2 }, 24);
+    auto pP30 = queue.createPoint({ 7.1, -5.2 }, 49);
+    auto pP31 = queue.createPoint({ 7.1, -5.3 }, 63);
+    auto pP32 = queue.createPoint({ 8.1, -3.3 }, 25);
+    auto pP33 = queue.createPoint({ 8.1, -2.4 }, 53);
+    auto pP34 = queue.createPoint({ 8.1, -1.4 }, 17);
+    auto pP35 = queue.createPoint({ 7.1, -3.5 }, 5);
+    auto pP36 = queue.createPoint({ 4.1, -4.5 }, 53);
+    auto pP37 = queue.createPoint({ 6.1, -4.6 }, 47);
+    auto pP38 = queue.createPoint({ 6.1, -5.6 }, 59);
+    auto pP39 = queue.createPoint({ 6.1, -5.7 }, 47);
+    auto pP40 = queue.createPoint({ 7.1, -5.7 }, 95);
+    auto pP41 = queue.createPoint({ 7.1, -5.8 }, 93);
+    auto pP42 = queue.createPoint({ 8.1, -3.8 }, 85);
+    auto pP43 = queue.createPoint({ 8.1, -2.9 }, 59);
+    auto pP44 = queue.createPoint({ 8.1, -1.11 }, 5);
+    auto pP45 = queue.createPoint({ 7.1, -3.11 }, 46);
+    auto pP46 = queue.createPoint({ 4.1, -4.11 }, 83);
+    auto pP47 = queue.createPoint({ 6.1, -4.8 }, 54);
+    auto pP48 = queue.createPoint({ 6.1, -5.9 }, 38);
+    auto pP49 = queue.createPoint({ 6.1, -5.11 }, 18);
 
     // Set P1 for these points
-    pP6->setP1(true);
-    pP7->setP1(true);
-    pP8->setP1(true);
-    pP13->setP1(true);
-    pP14->setP1(true);
-    pP15->setP1(true);
-    pP16->setP1(true);
-    pP17->setP1(true);
-    pP23->setP1(true);
+    queue.getPoint(pP6).setP1(true);
+    queue.getPoint(pP7).setP1(true);
+    queue.getPoint(pP8).setP1(true);
+    queue.getPoint(pP13).setP1(true);
+    queue.getPoint(pP14).setP1(true);
+    queue.getPoint(pP15).setP1(true);
+    queue.getPoint(pP16).setP1(true);
+    queue.getPoint(pP17).setP1(true);
+    queue.getPoint(pP23).setP1(true);
 
     // Start all processes
     #pragma omp parallel num_threads(nbThreads) default(shared)
@@ -160,7 +209,7 @@ int main(int argc , char **argv)
         // The first nbMainThreads threads that reach this point are considered main threads.
         // The master thread (number 0) has to be in that set.
         int threadNum = omp_get_thread_num();
-        #pragma omp critical(printInfo)
+        #pragma omp critical(addMainThread)
         {
             if (queue.getNbMainThreads() < nbMainThreads)
             {
@@ -172,12 +221,12 @@ int main(int argc , char **argv)
 
         #pragma omp single
         {
-            std::cout << "Main threads are:";
+            std::string mainThreads;
             for (int thnum : queue.getMainThreads())
             {
-                std::cout << " " << thnum;
+                mainThreads += " " + std::to_string(thnum);
             }
-            std::cout << std::endl;
+            LOG_INFO("Main threads are:" << mainThreads);
         }
 
 
@@ -188,7 +237,7 @@ int main(int argc , char **argv)
             {
                 //std::cout << "Start adding points for main thread " << threadNum << std::endl;
                 queue.startAdding();
-                for (QueuePointPtr pp : { pP1, pP2, pP3, pP4, pP5, pP6, pP7, pP8 })
+                for (QueuePointHandle pp : { pP1, pP2, pP3, pP4, pP5, pP6, pP7, pP8 })
                 {
                     queue.addToQueue(pp);
                 }
@@ -199,7 +248,7 @@ int main(int argc , char **argv)
             {
                 //std::cout << "Start adding points for main thread " << threadNum << std::endl;
                 queue.startAdding();
-                for (QueuePointPtr pp : { pP9, pP10, pP11, pP12, pP13, pP14, pP15, pP16 })
+                for (QueuePointHandle pp : { pP9, pP10, pP11, pP12, pP13, pP14, pP15, pP16 })
                 {
                     queue.addToQueue(pp);
                 }
@@ -210,7 +259,7 @@ int main(int argc , char **argv)
             {
                 //std::cout << "Start adding points for main thread " << threadNum << std::endl;
                 queue.startAdding();
-                for (QueuePointPtr pp : { pP17, pP18, pP19, pP20, pP21, pP22, pP23, pP24 })
+                for (QueuePointHandle pp : { pP17, pP18, pP19, pP20, pP21, pP22, pP23, pP24 })
                 {
                     queue.addToQueue(pp);
                 }
@@ -224,15 +273,9 @@ int main(int argc , char **argv)
         //#pragma omp barrier
 
         // Launch evaluation on all threads, including master.
-        #pragma omp critical(printInfo)
-        {
-            std::cout << "Launch run for thread " << omp_get_thread_num() << std::endl;
-        }
+        LOG_INFO("Launch run for thread " << omp_get_thread_num());
         queue.run();
-        #pragma omp critical(printInfo)
-        {
-            std::cout << "Done running for thread " << omp_get_thread_num() << std::endl;
-        }
+        LOG_INFO("Done running for thread " << omp_get_thread_num());
 
         // From here, only main threads are out of queue.run(). The other
         // threads are waiting for evaluation.
@@ -250,12 +293,9 @@ int main(int argc , char **argv)
 
             #pragma omp single nowait
             {
-                #pragma omp critical(printInfo)
-                {
-                    std::cout << std::endl << "Adding new points via main thread " << threadNum << "..." << std::endl;
-                }
+                LOG_INFO(std::endl << "Adding new points via main thread " << threadNum << "...");
                 queue.startAdding();
-                for (QueuePointPtr pp : { pP1, pP2, pP3, pP4, pP5, pP6, pP13, pP14, \
+                for (QueuePointHandle pp : { pP1, pP2, pP3, pP4, pP5, pP6, pP13, pP14, \
                                           pP15, pP16, pP17, pP18, pP19, pP20, pP21, \
                                         })
                 {
@@ -265,12 +305,9 @@ int main(int argc , char **argv)
             }
             #pragma omp single nowait
             {
-                #pragma omp critical(printInfo)
-                {
-                    std::cout << std::endl << "Adding new points via main thread " << threadNum << "..." << std::endl;
-                }
+                LOG_INFO(std::endl << "Adding new points via main thread " << threadNum << "...");
                 queue.startAdding();
-                for (QueuePointPtr pp : { pP22, pP23, pP24, pP25, pP26, pP27, pP28, \
+                for (QueuePointHandle pp : { pP22, pP23, pP24, pP25, pP26, pP27, pP28, \
                                           pP29, pP30, pP31, pP32, pP33, pP34, pP35, \
                                         })
                 {
@@ -280,12 +317,9 @@ int main(int argc , char **argv)
             }
             #pragma omp single nowait
             {
-                #pragma omp critical(printInfo)
-                {
-                    std::cout << std::endl << "Adding new points via main thread " << threadNum << "..." << std::endl;
-                }
+                LOG_INFO(std::endl << "Adding new points via main thread " << threadNum << "...");
                 queue.startAdding();
-                for (QueuePointPtr pp : { pP36, pP37, pP38, pP39, pP40, pP41, pP42, \
+                for (QueuePointHandle pp : { pP36, pP37, pP38, pP39, pP40, pP41, pP42, \
                                           pP43, pP44, pP45, pP46, pP47, pP48, pP49
                                         })
                 {
@@ -296,20 +330,27 @@ int main(int argc , char **argv)
 
             // All the threads other than main are still available for evaluation.
             // Re-launch run for main threads only.
-            #pragma omp critical(printInfo)
-            {
-                std::cout << "ReLaunch run for thread " << omp_get_thread_num() << std::endl;
-            }
+            LOG_INFO("ReLaunch run for thread " << omp_get_thread_num());
             queue.run();
 
-            #pragma omp critical(printInfo)
-            {
-                std::cout << "Ready to stop for main thread " << omp_get_thread_num() << std::endl;
-            }
-            // Stop queue for this main thread
+            LOG_INFO("Ready to stop for main thread " << omp_get_thread_num());
+            // Stop queue for this main thread: it gives up the main role.
             queue.stop();
+            // This thread is now a secondary thread. Instead of idling at
+            // the end of the parallel region, it evaluates the points of
+            // the other main threads: run() returns when they are all
+            // stopped.
+            queue.run();
         }   // End main thread
     }   // End parallel region
 
+    // Messages of all threads are written before the results.
+    Logger::flush();
+    if (displayStats)
+    {
+        queue.getStats().report(std::cout);
+    }
+    std::cout << "Cache hits: " << queue.getCache()->getNbHits() << " misses: " << queue.getCache()->getNbMisses() << std::endl;
+
     return 0;
 }
@@ -0,0 +1,980 @@
+#include "ProcessEvaluator.hpp"
+#include "Queue.hpp"
+
+#include <algorithm>    // For min
+#include <atomic>
+#include <cmath>        // For isnan
+#include <cstdio>       // For remove
+#include <iostream>
+#include <limits>       // For quiet_NaN
+#include <stdexcept>    // For invalid_argument, runtime_error
+#include <string>
+
+#include <unistd.h>     // For getpid
+
+// Regression tests of the Queue. Each test prints its name and the checks
+// that failed. The exit status is the number of failed checks.
+//
+// No calling argument.
+
+typedef BasicQueue<StaticLowerPriority<DefaultPriority>> TestQueue;
+
+static int nbFailures = 0;
+
+#define CHECK(condition) \
+    do \
+    { \
+        if (!(condition)) \
+        { \
+            std::cout << "  FAILED: " << #condition << " (line " << __LINE__ << ")" << std::endl; \
+            nbFailures++; \
+        } \
+    } while (0)
+
+
+// Evaluator that counts the points it evaluates. The eval of a point is
+// its first coordinate plus offset.
+class CountingEvaluator : public Evaluator
+{
+private:
+    double _offset;
+    mutable std::atomic<size_t> _nbEvals;
+
+public:
+    explicit CountingEvaluator(const double offset = 100.0)
+      : _offset(offset),
+        _nbEvals(0)
+    {}
+
+    size_t getNbEvals() const { return _nbEvals; }
+
+    void eval(const PointBatch& batch, double* evals) const override
+    {
+        for (size_t i = 0; i < batch.size(); i++)
+        {
+            evals[i] = batch.getCoords(i)[0] + _offset;
+        }
+        _nbEvals += batch.size();
+    }
+};
+
+
+// Evaluator whose first nbFailures evaluations fail.
+class FailingEvaluator : public CountingEvaluator
+{
+private:
+    mutable std::atomic<size_t> _nbFailures;
+
+public:
+    explicit FailingEvaluator(const size_t nbFailures)
+      : CountingEvaluator(),
+        _nbFailures(nbFailures)
+    {}
+
+    void eval(const PointBatch& batch, double* evals) const override
+    {
+        CountingEvaluator::eval(batch, evals);
+        for (size_t i = 0; i < batch.size(); i++)
+        {
+            if (_nbFailures > 0)
+            {
+                _nbFailures--;
+                evals[i] = std::numeric_limits<double>::quiet_NaN();
+            }
+        }
+    }
+};
+
+
+// A point added twice is popped twice in the same batch, and must be
+// evaluated once.
+static void testSameHandleTwice()
+{
+    std::cout << "testSameHandleTwice" << std::endl;
+    TestQueue queue((StaticLowerPriority<DefaultPriority>()));
+    auto evaluator = std::make_shared<CountingEvaluator>();
+    queue.setEvaluator(evaluator);
+    queue.setCache(nullptr);
+
+    QueuePointHandle handle = queue.createPoint({ 1.0, 2.0 }, 50.0);
+    queue.startAdding();
+    queue.addToQueue(handle);
+    queue.addToQueue(handle);
+    queue.stopAdding();
+    CHECK(2 == queue.getQueueSize());
+
+    size_t nbPoints = 0;
+    queue.evalBatch(10, nbPoints);
+    CHECK(2 == nbPoints);
+    CHECK(1 == evaluator->getNbEvals());
+    CHECK(101.0 == queue.getPoint(handle).getEval());
+    CHECK(0 == queue.getQueueSize());
+}
+
+
+// Two points with the same coordinates in the same batch both miss the
+// cache, and must be evaluated once.
+static void testSameCoordsTwice()
+{
+    std::cout << "testSameCoordsTwice" << std::endl;
+    TestQueue queue((StaticLowerPriority<DefaultPriority>()));
+    auto evaluator = std::make_shared<CountingEvaluator>();
+    queue.setEvaluator(evaluator);
+    queue.setCache(std::make_shared<EvalCache>());
+
+    QueuePointHandle handle1 = queue.createPoint({ 6.0, -2.0 }, 50.0);
+    QueuePointHandle handle2 = queue.createPoint({ 6.0, -2.0 }, 50.0);
+    QueuePointHandle handle3 = queue.createPoint({ 7.0, -2.0 }, 50.0);
+    queue.startAdding();
+    for (const auto& handle : { handle1, handle2, handle3, handle1 })
+    {
+        queue.addToQueue(handle);
+    }
+    queue.stopAdding();
+
+    size_t nbPoints = 0;
+    queue.evalBatch(10, nbPoints);
+    CHECK(4 == nbPoints);
+    CHECK(2 == evaluator->getNbEvals());
+    CHECK(106.0 == queue.getPoint(handle1).getEval());
+    CHECK(106.0 == queue.getPoint(handle2).getEval());
+    CHECK(107.0 == queue.getPoint(handle3).getEval());
+}
+
+
+// Asynchronous evaluation: a point added twice, and a point with the same
+// coordinates, are submitted once.
+static void testAsyncDuplicates(const bool withCache)
+{
+    std::cout << "testAsyncDuplicates " << (withCache ? "with" : "without") << " cache" << std::endl;
+    TestQueue queue((StaticLowerPriority<DefaultPriority>()));
+    auto evaluator = std::make_shared<CountingEvaluator>();
+    queue.setEvaluator(evaluator);
+    queue.setAsyncEvaluator(std::make_shared<SimulatedAsyncEvaluator>(evaluator, 0.001), 10);
+    queue.setCache(withCache ? std::make_shared<EvalCache>() : nullptr);
+
+    // P1 points: run() returns when they are all evaluated.
+    const std::vector<double> coords = { 6.0, -2.0 };
+    QueuePoint point(coords.data(), coords.size(), 50.0);
+    point.setP1(true);
+    QueuePointHandle handle1 = queue.createPoint(point);
+    QueuePointHandle handle2 = queue.createPoint(point);
+    queue.startAdding();
+    for (const auto& handle : { handle1, handle1, handle2 })
+    {
+        queue.addToQueue(handle);
+    }
+    queue.stopAdding();
+
+    queue.run();
+    CHECK(1 == evaluator->getNbEvals());
+    CHECK(106.0 == queue.getPoint(handle1).getEval());
+    CHECK(106.0 == queue.getPoint(handle2).getEval());
+    CHECK(0 == queue.getQueueSize());
+}
+
+
+// Without direction, the cost of a point is its squared norm. A direction
+// of another dimension is rejected.
+static void testDirectionPriority()
+{
+    std::cout << "testDirectionPriority" << std::endl;
+    const std::vector<double> coords = { 3.0, -4.0 };
+    QueuePoint point(coords.data(), coords.size(), 50.0);
+    PointBatch batch;
+    batch.add(point);
+    double cost = 0;
+
+    DirectionPriority noDirection;
+    noDirection.costs(batch, &cost);
+    CHECK(25.0 == cost);
+
+    DirectionPriority direction({ 3.0, -2.0 });
+    direction.costs(batch, &cost);
+    CHECK(4.0 == cost);
+
+    DirectionPriority wrongDirection({ 1.0, 2.0, 3.0 });
+    bool thrown = false;
+    try
+    {
+        wrongDirection.costs(batch, &cost);
+    }
+    catch (const std::invalid_argument&)
+    {
+        thrown = true;
+    }
+    CHECK(thrown);
+}
+
+
+// Threads add points while other threads pop them: the number of points
+// and of P1 points in the queue is never negative.
+static void testCountersUnderLoad(const QueueBackend backend, const std::string& backendName)
+{
+    std::cout << "testCountersUnderLoad " << backendName << std::endl;
+    const int nbThreads = 4;
+    const int nbMainThreads = 2;
+    const size_t nbBatches = 1000;
+    const size_t nbPointsPerBatch = 20;
+    Threading::setMaxThreads(nbThreads);
+    TestQueue queue((StaticLowerPriority<DefaultPriority>()), backend);
+    auto evaluator = std::make_shared<CountingEvaluator>();
+    queue.setEvaluator(evaluator);
+    queue.setCache(nullptr);
+    for (int threadNum = 1; threadNum < nbMainThreads; threadNum++)
+    {
+        queue.addMainThread(threadNum);
+    }
+
+    std::atomic<int> minQueueSize(0);
+    std::atomic<int> minNbP1(0);
+    std::atomic<int> nbMainDone(0);
+    auto checkCounters = [&]()
+    {
+        const int queueSize = queue.getQueueSize();
+        const int nbP1 = queue.getNbP1();
+        if (queueSize < minQueueSize)
+        {
+            minQueueSize = queueSize;
+        }
+        if (nbP1 < minNbP1)
+        {
+            minNbP1 = nbP1;
+        }
+    };
+
+    #pragma omp parallel num_threads(nbThreads) default(shared)
+    {
+        const int threadNum = omp_get_thread_num();
+        size_t nbPoints = 0;
+        if (threadNum < nbMainThreads)
+        {
+            for (size_t batch = 0; batch < nbBatches; batch++)
+            {
+                queue.startAdding();
+                for (size_t i = 0; i < nbPointsPerBatch; i++)
+                {
+                    const std::vector<double> coords = { double(threadNum), double(batch * nbPointsPerBatch + i) };
+                    QueuePoint point(coords.data(), coords.size(), 50.0);
+                    point.setP1(0 == i % 3);
+                    queue.addToQueue(queue.createPoint(point));
+                }
+                queue.stopAdding();
+                checkCounters();
+                queue.evalBatch(5, nbPoints);
+                checkCounters();
+            }
+            nbMainDone++;
+        }
+        else
+        {
+            while (nbMainDone < nbMainThreads)
+            {
+                queue.evalBatch(5, nbPoints);
+                checkCounters();
+            }
+        }
+    }
+
+    // Empty the queue.
+    size_t nbPoints = 1;
+    while (nbPoints > 0)
+    {
+        queue.evalBatch(100, nbPoints);
+    }
+    CHECK(0 == minQueueSize);
+    CHECK(0 == minNbP1);
+    CHECK(0 == queue.getQueueSize());
+    CHECK(0 == queue.getNbP1());
+    CHECK(nbMainThreads * nbBatches * nbPointsPerBatch == evaluator->getNbEvals());
+    Threading::setMaxThreads(0);
+}
+
+
+// Points added by two main threads: P1 points are popped before all
+// other points, even when the other points have a higher priority.
+static void testP1First(const QueueBackend backend, const std::string& backendName)
+{
+    std::cout << "testP1First " << backendName << std::endl;
+    const int nbThreads = 4;
+    Threading::setMaxThreads(nbThreads);
+    TestQueue queue((StaticLowerPriority<DefaultPriority>()), backend);
+    queue.addMainThread(1);
+
+    // Each main thread adds to its own SubQueue with PER_MAIN_THREAD.
+    const size_t nbPoints = 20;
+    for (int threadNum = 0; threadNum < 2; threadNum++)
+    {
+        Threading::setThreadNum(threadNum, nbThreads);
+        queue.startAdding();
+        for (size_t i = 0; i < nbPoints; i++)
+        {
+            const bool p1 = (0 == i % 4);
+            const std::vector<double> coords = { double(threadNum), double(i) };
+            QueuePoint point(coords.data(), coords.size(), p1 ? 100.0 : 1.0);
+            point.setP1(p1);
+            queue.addToQueue(queue.createPoint(point));
+        }
+        queue.stopAdding();
+    }
+    CHECK(2 * nbPoints / 4 == size_t(queue.getNbP1()));
+
+    // A thread that is not a main thread pops them.
+    Threading::setThreadNum(2, nbThreads);
+    size_t nbPopped = 0;
+    size_t nbP1Popped = 0;
+    bool nonP1Popped = false;
+    QueuePointHandle handle;
+    while (queue.popPoint(handle))
+    {
+        nbPopped++;
+        if (queue.getPoint(handle).getP1())
+        {
+            CHECK(!nonP1Popped);
+            nbP1Popped++;
+        }
+        else
+        {
+            nonP1Popped = true;
+        }
+    }
+    CHECK(2 * nbPoints == nbPopped);
+    CHECK(2 * nbPoints / 4 == nbP1Popped);
+    CHECK(0 == queue.getQueueSize());
+    CHECK(0 == queue.getNbP1());
+
+    Threading::setThreadNum(-1);
+    Threading::setMaxThreads(0);
+}
+
+
+// Without cost function, the dimension of the direction is checked when
+// points are added, not in the comparisons.
+static void testCompOnlyDimension()
+{
+    std::cout << "testCompOnlyDimension" << std::endl;
+    typedef StaticLowerPriority<CompOnly<DirectionPriority>> CompOnlyPriority;
+    BasicQueue<CompOnlyPriority> queue(CompOnlyPriority(CompOnly<DirectionPriority>(DirectionPriority({ 1.0, 2.0, 3.0 }))));
+    queue.setEvaluator(std::make_shared<CountingEvaluator>());
+
+    queue.startAdding();
+    queue.addToQueue(queue.createPoint({ 1.0, 2.0 }, 50.0));
+    queue.addToQueue(queue.createPoint({ 3.0, 4.0 }, 50.0));
+    bool thrown = false;
+    try
+    {
+        queue.stopAdding();
+    }
+    catch (const std::invalid_argument&)
+    {
+        thrown = true;
+    }
+    CHECK(thrown);
+    CHECK(0 == queue.getQueueSize());
+
+    // Same for a new order.
+    thrown = false;
+    try
+    {
+        queue.sort(CompOnlyPriority(CompOnly<DirectionPriority>(DirectionPriority({ 1.0 }))));
+    }
+    catch (const std::invalid_argument&)
+    {
+        thrown = true;
+    }
+    CHECK(thrown);
+
+    // Points closest to the direction first.
+    queue.sort(CompOnlyPriority(CompOnly<DirectionPriority>(DirectionPriority({ 3.0, 4.0 }))));
+    QueuePointHandle far = queue.createPoint({ 1.0, 2.0 }, 50.0);
+    QueuePointHandle close = queue.createPoint({ 3.0, 3.0 }, 50.0);
+    queue.startAdding();
+    queue.addToQueue(far);
+    queue.addToQueue(close);
+    queue.stopAdding();
+    QueuePointHandle handle;
+    CHECK(queue.popPoint(handle) && handle == close);
+    CHECK(queue.popPoint(handle) && handle == far);
+}
+
+
+// An evaluation of 0, e.g. at the optimum of the test functions, is an
+// evaluation: the point is not evaluated again, and duplicates get it.
+static void testZeroEval()
+{
+    std::cout << "testZeroEval" << std::endl;
+    TestQueue queue((StaticLowerPriority<DefaultPriority>()));
+    auto evaluator = std::make_shared<CountingEvaluator>(0.0);
+    queue.setEvaluator(evaluator);
+    queue.setCache(nullptr);
+
+    QueuePointHandle handle1 = queue.createPoint({ 0.0, 0.0 }, 50.0);
+    QueuePointHandle handle2 = queue.createPoint({ 0.0, 0.0 }, 50.0);
+    CHECK(!queue.getPoint(handle1).isEvaluated());
+    queue.startAdding();
+    for (const auto& handle : { handle1, handle2, handle1 })
+    {
+        queue.addToQueue(handle);
+    }
+    queue.stopAdding();
+
+    size_t nbPoints = 0;
+    queue.evalBatch(10, nbPoints);
+    CHECK(3 == nbPoints);
+    CHECK(1 == evaluator->getNbEvals());
+    CHECK(queue.getPoint(handle1).isEvaluated());
+    CHECK(queue.getPoint(handle2).isEvaluated());
+    CHECK(0.0 == queue.getPoint(handle2).getEval());
+
+    // An evaluated point is not queued again.
+    queue.startAdding();
+    queue.addToQueue(handle1);
+    queue.stopAdding();
+    CHECK(0 == queue.getQueueSize());
+    CHECK(1 == evaluator->getNbEvals());
+}
+
+
+// A failed evaluation is not cached, nor a success: a point with the same
+// coordinates is evaluated again.
+static void testFailedEval()
+{
+    std::cout << "testFailedEval" << std::endl;
+    TestQueue queue((StaticLowerPriority<DefaultPriority>()));
+    auto evaluator = std::make_shared<FailingEvaluator>(1);
+    queue.setEvaluator(evaluator);
+    queue.setCache(std::make_shared<EvalCache>());
+
+    QueuePointHandle handle1 = queue.createPoint({ 6.0, -2.0 }, 50.0);
+    queue.startAdding();
+    queue.addToQueue(handle1);
+    queue.stopAdding();
+    size_t nbPoints = 0;
+    CHECK(!queue.evalBatch(10, nbPoints));
+    CHECK(queue.getPoint(handle1).isEvaluated());
+    CHECK(std::isnan(queue.getPoint(handle1).getEval()));
+    CHECK(queue.getIncumbent() > 1000.0);
+
+    QueuePointHandle handle2 = queue.createPoint({ 6.0, -2.0 }, 500.0);
+    queue.startAdding();
+    queue.addToQueue(handle2);
+    queue.stopAdding();
+    CHECK(queue.evalBatch(10, nbPoints));
+    CHECK(2 == evaluator->getNbEvals());
+    CHECK(106.0 == queue.getPoint(handle2).getEval());
+}
+
+
+// A new queue reloads the evaluations of a journal in its cache: the
+// points evaluated by the first queue are not queued again. Failed
+// evaluations are not journaled.
+static void testJournalReload()
+{
+    std::cout << "testJournalReload" << std::endl;
+    const std::string fileName = "/tmp/testqueue-" + std::to_string(getpid()) + ".journal";
+    std::remove(fileName.c_str());
+    const std::vector<std::vector<double>> coords = { { 1.0, 0.0 }, { 2.0, 0.0 }, { 3.0, 0.0 } };
+
+    double bestEval = 1000.0;
+    {
+        TestQueue queue((StaticLowerPriority<DefaultPriority>()));
+        queue.setEvaluator(std::make_shared<FailingEvaluator>(1));
+        queue.setCache(std::make_shared<EvalCache>());
+        CHECK(0 == queue.setJournal(std::make_shared<EvalJournal>(fileName, queue.getDimension())));
+        std::vector<QueuePointHandle> handles;
+        queue.startAdding();
+        for (const auto& point : coords)
+        {
+            handles.push_back(queue.createPoint(point, 50.0));
+            queue.addToQueue(handles.back());
+        }
+        queue.stopAdding();
+        size_t nbPoints = 0;
+        queue.evalBatch(10, nbPoints);
+        for (const auto& handle : handles)
+        {
+            if (!std::isnan(queue.getPoint(handle).getEval()))
+            {
+                bestEval = std::min(bestEval, queue.getPoint(handle).getEval());
+            }
+        }
+    }
+
+    TestQueue queue((StaticLowerPriority<DefaultPriority>()));
+    auto evaluator = std::make_shared<CountingEvaluator>();
+    queue.setEvaluator(evaluator);
+    queue.setCache(std::make_shared<EvalCache>());
+    CHECK(2 == queue.setJournal(std::make_shared<EvalJournal>(fileName, queue.getDimension())));
+    CHECK(bestEval == queue.getIncumbent());
+    queue.startAdding();
+    for (const auto& point : coords)
+    {
+        queue.addToQueue(queue.createPoint(point, 50.0));
+    }
+    queue.stopAdding();
+    CHECK(1 == queue.getQueueSize());
+    size_t nbPoints = 0;
+    queue.evalBatch(10, nbPoints);
+    CHECK(1 == evaluator->getNbEvals());
+    CHECK(3 == queue.getJournal()->getNbRecords());
+
+    queue.setJournal(nullptr);
+    std::remove(fileName.c_str());
+}
+
+
+// A worker command that cannot be run is rejected when the evaluator is
+// created. A worker that does not reply in time is restarted, and its
+// points fail.
+static void testProcessEvaluatorFailures()
+{
+    std::cout << "testProcessEvaluatorFailures" << std::endl;
+    bool thrown = false;
+    try
+    {
+        ProcessEvaluator evaluator({ "./no-such-worker" }, 1);
+    }
+    catch (const std::runtime_error&)
+    {
+        thrown = true;
+    }
+    CHECK(thrown);
+
+    // The worker reads the requests, and never replies.
+    ProcessEvaluator evaluator({ "sh", "-c", "cat > /dev/null" }, 1, 0.1);
+    const std::vector<double> coords = { 1.0, 2.0 };
+    PointBatch batch;
+    batch.add(QueuePoint(coords.data(), coords.size(), 50.0));
+    double eval = 0.0;
+    evaluator.eval(batch, &eval);
+    CHECK(std::isnan(eval));
+
+    const uint64_t tag = 7;
+    evaluator.submit(batch, &tag);
+    std::vector<AsyncResult> results;
+    for (int i = 0; i < 100 && results.empty(); i++)
+    {
+        evaluator.poll(results, 0.1);
+    }
+    CHECK(1 == results.size());
+    CHECK(!results.empty() && tag == results[0]._tag && std::isnan(results[0]._eval));
+}
+
+
+// Points added by a thread before cancelPoints() are skipped when popped;
+// points added after are not.
+static void testCancelPoints()
+{
+    std::cout << "testCancelPoints" << std::endl;
+    TestQueue queue((StaticLowerPriority<DefaultPriority>()));
+    auto evaluator = std::make_shared<CountingEvaluator>();
+    queue.setEvaluator(evaluator);
+    queue.setStatsEnabled(true);
+
+    queue.startAdding();
+    for (double x = 0; x < 5; x++)
+    {
+        queue.addToQueue(queue.createPoint({ x, 0.0 }, 50.0));
+    }
+    queue.stopAdding();
+    const uint32_t epoch = queue.getEpoch(0);
+    queue.cancelPoints(0);
+    CHECK(epoch + 1 == queue.getEpoch(0));
+
+    QueuePointHandle handle = queue.createPoint({ 10.0, 0.0 }, 50.0);
+    queue.startAdding();
+    queue.addToQueue(handle);
+    queue.stopAdding();
+
+    size_t nbPoints = 0;
+    queue.evalBatch(10, nbPoints);
+    CHECK(1 == nbPoints);
+    CHECK(1 == evaluator->getNbEvals());
+    CHECK(queue.getPoint(handle).isEvaluated());
+    CHECK(5 == queue.getStats().getTotal().getNbStalePops());
+    CHECK(0 == queue.getQueueSize());
+}
+
+
+// After setAllP1ToFalse(), former P1 points are ordered with the others.
+static void testSetAllP1ToFalse()
+{
+    std::cout << "testSetAllP1ToFalse" << std::endl;
+    TestQueue queue((StaticLowerPriority<DefaultPriority>()));
+
+    std::vector<QueuePointHandle> handles;
+    queue.startAdding();
+    for (size_t i = 0; i < 6; i++)
+    {
+        // Best evals 6 to 1: P1 points have the lowest priority.
+        const std::vector<double> coords = { double(i), 0.0 };
+        QueuePoint point(coords.data(), coords.size(), 6.0 - double(i));
+        point.setP1(i < 3);
+        handles.push_back(queue.createPoint(point));
+        queue.addToQueue(handles.back());
+    }
+    queue.stopAdding();
+    CHECK(3 == queue.getNbP1());
+    CHECK(queue.getTopPoint() == handles[2]);
+
+    queue.setAllP1ToFalse();
+    CHECK(0 == queue.getNbP1());
+    CHECK(6 == queue.getQueueSize());
+    for (size_t i = 0; i < 6; i++)
+    {
+        QueuePointHandle handle;
+        CHECK(queue.popPoint(handle) && handle == handles[5 - i]);
+        CHECK(!queue.getPoint(handle).getP1());
+    }
+    CHECK(0 == queue.getQueueSize());
+}
+
+
+// Points with a lower bound that is not better than the incumbent are
+// dropped when popped, without evaluation.
+static void testPruning()
+{
+    std::cout << "testPruning" << std::endl;
+    TestQueue queue((StaticLowerPriority<DefaultPriority>()));
+    auto evaluator = std::make_shared<CountingEvaluator>();
+    queue.setEvaluator(evaluator);
+    queue.setStatsEnabled(true);
+    queue.setIncumbent(110.0);
+
+    std::vector<QueuePointHandle> handles;
+    queue.startAdding();
+    for (size_t i = 0; i < 4; i++)
+    {
+        // Lower bounds 90, 105, 110 and 120.
+        const std::vector<double> coords = { double(i), 0.0 };
+        QueuePoint point(coords.data(), coords.size(), 200.0);
+        const double lowerBounds[] = { 90.0, 105.0, 110.0, 120.0 };
+        point.setLowerBound(lowerBounds[i]);
+        handles.push_back(queue.createPoint(point));
+        queue.addToQueue(handles.back());
+    }
+    queue.stopAdding();
+
+    size_t nbPoints = 0;
+    queue.evalBatch(10, nbPoints);
+    CHECK(2 == evaluator->getNbEvals());
+    CHECK(queue.getPoint(handles[0]).isEvaluated());
+    CHECK(queue.getPoint(handles[1]).isEvaluated());
+    CHECK(!queue.getPoint(handles[2]).isEvaluated());
+    CHECK(!queue.getPoint(handles[3]).isEvaluated());
+    CHECK(2 == queue.getStats().getTotal().getNbPrunedPops());
+    // Evals 100 and 101: the incumbent is the best of them.
+    CHECK(100.0 == queue.getIncumbent());
+    CHECK(0 == queue.getQueueSize());
+}
+
+
+// Threads take and give up the main role. The last main thread to stop
+// ends the evaluation: no thread can become a main thread after that.
+static void testMainThreadRoles()
+{
+    std::cout << "testMainThreadRoles" << std::endl;
+    const int nbThreads = 4;
+    Threading::setMaxThreads(nbThreads);
+    TestQueue queue((StaticLowerPriority<DefaultPriority>()));
+    queue.setEvaluator(std::make_shared<CountingEvaluator>());
+
+    CHECK(queue.isMainThread(0));
+    CHECK(1 == queue.getNbMainThreads());
+    CHECK(queue.addMainThread(2));
+    CHECK(!queue.addMainThread(2));
+    CHECK(2 == queue.getNbMainThreads());
+    CHECK((std::vector<int>{ 0, 2 }) == queue.getMainThreads());
+
+    // Thread 2 gives up its role: evaluation goes on for thread 0.
+    Threading::setThreadNum(2, nbThreads);
+    queue.stop();
+    CHECK(!queue.isMainThread(2));
+    CHECK(1 == queue.getNbMainThreads());
+    CHECK(queue.addMainThread(3));
+
+    for (int threadNum : { 0, 3 })
+    {
+        Threading::setThreadNum(threadNum, nbThreads);
+        queue.stop();
+    }
+    CHECK(0 == queue.getNbMainThreads());
+    CHECK(!queue.addMainThread(1));
+    // Evaluation is done: run() returns at once, on any thread.
+    Threading::setThreadNum(1, nbThreads);
+    queue.run();
+
+    Threading::setThreadNum(-1);
+    Threading::setMaxThreads(0);
+}
+
+
+// Each thread of a WorkerPool runs the job with its own thread number,
+// and waits for the others at the barrier. Exceptions reach run().
+static void testWorkerPool()
+{
+    std::cout << "testWorkerPool" << std::endl;
+    const int nbThreads = 4;
+    WorkerPool pool(nbThreads);
+    CHECK(nbThreads == pool.getNbThreads());
+
+    std::vector<int> threadNums(nbThreads, -1);
+    std::vector<int> teamSizes(nbThreads, 0);
+    std::atomic<int> nbBeforeBarrier(0);
+    std::atomic<bool> barrierPassed(true);
+    pool.run([&](const int threadNum)
+    {
+        threadNums[threadNum] = Threading::getThreadNum();
+        teamSizes[threadNum] = Threading::getNbThreads();
+        nbBeforeBarrier++;
+        pool.barrier();
+        if (nbThreads != nbBeforeBarrier)
+        {
+            barrierPassed = false;
+        }
+    });
+    for (int threadNum = 0; threadNum < nbThreads; threadNum++)
+    {
+        CHECK(threadNum == threadNums[threadNum]);
+        CHECK(nbThreads == teamSizes[threadNum]);
+    }
+    CHECK(barrierPassed);
+
+    // The pool is reused for the next job.
+    std::atomic<int> sum(0);
+    pool.run([&sum](const int threadNum) { sum += threadNum; });
+    CHECK(0 + 1 + 2 + 3 == sum);
+
+    bool thrown = false;
+    try
+    {
+        pool.run([](const int threadNum)
+        {
+            if (1 == threadNum)
+            {
+                throw std::runtime_error("job failed");
+            }
+        });
+    }
+    catch (const std::runtime_error&)
+    {
+        thrown = true;
+    }
+    CHECK(thrown);
+}
+
+
+
+// Points popped and added while rekey() reorders the heaps: each point is
+// popped exactly once, and the queue ends empty.
+static void testRekeyUnderLoad(const QueueBackend backend, const std::string& backendName)
+{
+    std::cout << "testRekeyUnderLoad " << backendName << std::endl;
+    typedef StaticLowerPriority<DirectionPriority> RekeyPriority;
+    const int nbThreads = 4;
+    const size_t nbInitialPoints = 20000;
+    const size_t nbAddedPoints = 20000;
+    const size_t nbRekeys = 20;
+    Threading::setMaxThreads(nbThreads);
+    BasicQueue<RekeyPriority> queue(RekeyPriority(DirectionPriority({ 1.0, 0.0 })), backend);
+    queue.setCache(nullptr);
+    queue.addMainThread(1);
+
+    // Point i has coordinates (i % 7, i).
+    auto addPoints = [&queue](const size_t start, const size_t end)
+    {
+        queue.startAdding();
+        for (size_t i = start; i < end; i++)
+        {
+            queue.addToQueue(queue.createPoint({ double(i % 7), double(i) }, 50.0));
+        }
+        queue.stopAdding();
+    };
+    std::unique_ptr<std::atomic<int>[]> nbPops(new std::atomic<int>[nbInitialPoints + nbAddedPoints]);
+    for (size_t i = 0; i < nbInitialPoints + nbAddedPoints; i++)
+    {
+        nbPops[i] = 0;
+    }
+    auto popPoints = [&queue, &nbPops](const size_t n)
+    {
+        std::vector<QueuePointHandle> handles;
+        const size_t nbPopped = queue.popBatch(n, handles);
+        for (const auto& handle : handles)
+        {
+            nbPops[size_t(queue.getPoint(handle).getCoords()[1])]++;
+        }
+        return nbPopped;
+    };
+    addPoints(0, nbInitialPoints);
+
+    std::atomic<bool> rekeyDone(false);
+    std::atomic<bool> addDone(false);
+    #pragma omp parallel num_threads(nbThreads) default(shared)
+    {
+        const int threadNum = omp_get_thread_num();
+        if (0 == threadNum)
+        {
+            for (size_t i = 0; i < nbRekeys; i++)
+            {
+                queue.rekey(RekeyPriority(DirectionPriority({ (0 == i % 2) ? -1.0 : 1.0, 1.0 })));
+            }
+            rekeyDone = true;
+        }
+        else if (1 == threadNum)
+        {
+            for (size_t start = nbInitialPoints; start < nbInitialPoints + nbAddedPoints; start += 100)
+            {
+                addPoints(start, start + 100);
+                popPoints(10);
+            }
+            addDone = true;
+        }
+        else
+        {
+            while (!rekeyDone || !addDone)
+            {
+                popPoints(10);
+            }
+        }
+    }
+
+    // Empty the queue.
+    while (popPoints(100) > 0)
+    {
+    }
+    size_t nbWrongPops = 0;
+    for (size_t i = 0; i < nbInitialPoints + nbAddedPoints; i++)
+    {
+        nbWrongPops += (1 != nbPops[i]);
+    }
+    CHECK(0 == nbWrongPops);
+    CHECK(0 == queue.getQueueSize());
+    CHECK(0 == queue.getNbP1());
+    Threading::setMaxThreads(0);
+}
+
+
+// A large batch added right after rekey() is merged by rebuilding the
+// heaps, while other threads pop points. Points have few distinct costs,
+// so an entry popped during the rekey may reach the top of the rebuilt
+// heap: it must be dropped, not popped again.
+static void testMergeAfterRekey(const QueueBackend backend, const std::string& backendName)
+{
+    std::cout << "testMergeAfterRekey " << backendName << std::endl;
+    typedef StaticLowerPriority<DirectionPriority> RekeyPriority;
+    const int nbThreads = 4;
+    const size_t nbPointsPerBatch = 5000;
+    const size_t nbBatches = 10;
+    const size_t nbPoints = (nbBatches + 1) * nbPointsPerBatch;
+    Threading::setMaxThreads(nbThreads);
+    BasicQueue<RekeyPriority> queue(RekeyPriority(DirectionPriority({ 1.0, 0.0 })), backend);
+    queue.setCache(nullptr);
+
+    auto addPoints = [&queue](const size_t n)
+    {
+        queue.startAdding();
+        for (size_t i = 0; i < n; i++)
+        {
+            queue.addToQueue(queue.createPoint({ double(i % 2), 0.0 }, 50.0));
+        }
+        queue.stopAdding();
+    };
+    // Points are counted by arena index: they are never released.
+    std::unique_ptr<std::atomic<int>[]> nbPops(new std::atomic<int>[nbPoints]);
+    for (size_t i = 0; i < nbPoints; i++)
+    {
+        nbPops[i] = 0;
+    }
+    std::atomic<size_t> nbBadIndices(0);
+    auto popPoints = [&](const size_t n)
+    {
+        std::vector<QueuePointHandle> handles;
+        const size_t nbPopped = queue.popBatch(n, handles);
+        for (const auto& handle : handles)
+        {
+            if (handle.getIndex() < nbPoints)
+            {
+                nbPops[handle.getIndex()]++;
+            }
+            else
+            {
+                nbBadIndices++;
+            }
+        }
+        return nbPopped;
+    };
+    addPoints(nbPointsPerBatch);
+
+    std::atomic<bool> addDone(false);
+    #pragma omp parallel num_threads(nbThreads) default(shared)
+    {
+        if (0 == omp_get_thread_num())
+        {
+            for (size_t batch = 0; batch < nbBatches; batch++)
+            {
+                queue.rekey(RekeyPriority(DirectionPriority({ double(batch % 2), 0.0 })));
+                addPoints(nbPointsPerBatch);
+            }
+            addDone = true;
+        }
+        else
+        {
+            while (!addDone)
+            {
+                popPoints(10);
+            }
+        }
+    }
+
+    while (popPoints(100) > 0)
+    {
+    }
+    size_t nbWrongPops = 0;
+    for (size_t i = 0; i < nbPoints; i++)
+    {
+        nbWrongPops += (1 != nbPops[i]);
+    }
+    CHECK(0 == nbBadIndices);
+    CHECK(0 == nbWrongPops);
+    CHECK(0 == queue.getQueueSize());
+    Threading::setMaxThreads(0);
+}
+
+int main()
+{
+    // The queue logs each evaluation.
+    Logger::setLevel(LogLevel::WARNING);
+
+    testSameHandleTwice();
+    testSameCoordsTwice();
+    testZeroEval();
+    testFailedEval();
+    testJournalReload();
+    testProcessEvaluatorFailures();
+    testAsyncDuplicates(false);
+    testAsyncDuplicates(true);
+    testDirectionPriority();
+    testCompOnlyDimension();
+    testCancelPoints();
+    testSetAllP1ToFalse();
+    testPruning();
+    testMainThreadRoles();
+    testWorkerPool();
+    testCountersUnderLoad(QueueBackend::LOCKED, "locked");
+    testCountersUnderLoad(QueueBackend::MULTIQUEUE, "multiqueue");
+    testCountersUnderLoad(QueueBackend::PER_MAIN_THREAD, "permainthread");
+    testP1First(QueueBackend::LOCKED, "locked");
+    testP1First(QueueBackend::MULTIQUEUE, "multiqueue");
+    testP1First(QueueBackend::PER_MAIN_THREAD, "permainthread");
+    testRekeyUnderLoad(QueueBackend::LOCKED, "locked");
+    testRekeyUnderLoad(QueueBackend::MULTIQUEUE, "multiqueue");
+    testRekeyUnderLoad(QueueBackend::PER_MAIN_THREAD, "permainthread");
+    testMergeAfterRekey(QueueBackend::LOCKED, "locked");
+    testMergeAfterRekey(QueueBackend::MULTIQUEUE, "multiqueue");
+    testMergeAfterRekey(QueueBackend::PER_MAIN_THREAD, "permainthread");
+
+    Logger::flush();
+    std::cout << (0 == nbFailures ? "All tests passed" : std::to_string(nbFailures) + " checks failed") << std::endl;
+
+    return nbFailures;
+}